@@ -0,0 +1,205 @@
+/*
+ * Copyright(c) 2010 by Gabriel M. Beddingfield <gabriel@teuton.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY, without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/* Checks the bams_deinterleave kernels against the per-sample loops
+ * the file loaders used before, and times them.
+ *
+ *   bench_deinterleave [--check]
+ *
+ * With --check only the check runs.  That is what ctest runs.
+ */
+
+// The kernels are static, so include them.
+#include "bams_deinterleave.c"
+#include "bench_util.h"
+
+#include <vector>
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+	struct kernel_t {
+		const char *name;
+		deinterleave_float_t f;
+		deinterleave_s16_t s;
+	};
+
+	std::vector<kernel_t> kernels()
+	{
+		std::vector<kernel_t> k;
+
+		k.push_back( kernel_t{"c", deinterleave_float_c, deinterleave_s16_c} );
+#ifdef BAMS_X86_SIMD
+		__builtin_cpu_init();
+		if( __builtin_cpu_supports("sse2") )
+			k.push_back( kernel_t{"sse2", deinterleave_float_sse2, deinterleave_s16_sse2} );
+		if( __builtin_cpu_supports("avx2") )
+			k.push_back( kernel_t{"avx2", deinterleave_float_avx2, deinterleave_s16_avx2} );
+#endif
+		return k;
+	}
+
+	/* The libsndfile loader's old loop */
+	void old_float(const std::vector<float>& buf, int channels,
+		       std::vector<float>& left, std::vector<float>& right)
+	{
+		for(size_t k = 0 ; k < buf.size() ; ++k) {
+			unsigned mod = k % channels;
+			if( mod == 0 ) {
+				left.push_back( buf[k] );
+				if (channels == 1) // mono
+					right.push_back( buf[k] );
+			} else if( mod == 1 ) {
+				right.push_back( buf[k] );
+			}
+		}
+	}
+
+	/* The mpg123 loader's old loop */
+	void old_s16(const std::vector<int16_t>& buf, int channels,
+		     std::vector<float>& left, std::vector<float>& right)
+	{
+		for(size_t k = 0 ; k < buf.size() ; ++k) {
+			unsigned mod = k % channels;
+			if( mod == 0 ) {
+				left.push_back( (float)buf[k] / 32768.0f );
+			}
+			if( mod == 1 || channels == 1 ) {
+				right.push_back( (float)buf[k] / 32768.0f );
+			}
+		}
+	}
+
+	/* Compare one kernel's planes with the old loop's output.
+	 * The old loops copy mono to the right channel, the kernels
+	 * leave that to the caller.
+	 */
+	bool same(const std::vector<float>& l, const std::vector<float>& r,
+		  const float *pl, const float *pr, unsigned long frames, int dst_channels)
+	{
+		if( l.size() != frames ) return false;
+		if( memcmp(&l[0], pl, frames * sizeof(float)) ) return false;
+		if( dst_channels > 1 && memcmp(&r[0], pr, frames * sizeof(float)) ) return false;
+		return true;
+	}
+
+	int check(const std::vector<kernel_t>& ks)
+	{
+		static const int channel_counts[] = { 1, 2, 3, 6 };
+		uint32_t seed = 1;
+		int failures = 0;
+
+		for(int channels : channel_counts) {
+			int dst_channels = (channels > 1) ? 2 : 1;
+			for(unsigned long frames = 1 ; frames < 4200 ; frames += (frames < 80) ? 1 : 997) {
+				std::vector<float> fbuf(frames * channels);
+				std::vector<int16_t> sbuf(frames * channels);
+				for(size_t k = 0 ; k < fbuf.size() ; ++k) {
+					fbuf[k] = bench_rand_float(&seed, 1.0f);
+					sbuf[k] = int16_t(bench_rand(&seed));
+				}
+				sbuf[0] = -32768;
+				if( sbuf.size() > 1 ) sbuf[1] = 32767;
+
+				std::vector<float> fl, fr, sl, sr;
+				old_float(fbuf, channels, fl, fr);
+				old_s16(sbuf, channels, sl, sr);
+
+				for(const kernel_t& k : ks) {
+					std::vector<float> l(frames, -99.0f), r(frames, -99.0f);
+					float *dst[2] = { &l[0], &r[0] };
+
+					k.f(dst, dst_channels, &fbuf[0], channels, frames);
+					if( !same(fl, fr, dst[0], dst[1], frames, dst_channels) ) {
+						printf("FAIL float %s channels=%d frames=%lu\n", k.name, channels, frames);
+						++failures;
+					}
+					k.s(dst, dst_channels, &sbuf[0], channels, frames);
+					if( !same(sl, sr, dst[0], dst[1], frames, dst_channels) ) {
+						printf("FAIL s16 %s channels=%d frames=%lu\n", k.name, channels, frames);
+						++failures;
+					}
+				}
+			}
+		}
+		printf("deinterleave check: %s\n", failures ? "FAILED" : "ok");
+		return failures ? 1 : 0;
+	}
+
+	/* ns per stereo frame, best of a few runs */
+	template <typename Fn>
+	double time_it(unsigned long frames, Fn fn)
+	{
+		double best = 1e9;
+		for(int run = 0 ; run < 5 ; ++run) {
+			double t = bench_now();
+			fn();
+			t = bench_now() - t;
+			if( t < best ) best = t;
+		}
+		return best * 1e9 / frames;
+	}
+
+	void bench(const std::vector<kernel_t>& ks)
+	{
+		const unsigned long frames = 1UL << 21;  // ~48 sec at 44.1 kHz
+		std::vector<float> fbuf(2 * frames);
+		std::vector<int16_t> sbuf(2 * frames);
+		std::vector<float> l(frames), r(frames);
+		float *dst[2] = { &l[0], &r[0] };
+		uint32_t seed = 7;
+		double old_f, old_s, t;
+
+		for(size_t k = 0 ; k < fbuf.size() ; ++k) {
+			fbuf[k] = bench_rand_float(&seed, 1.0f);
+			sbuf[k] = int16_t(bench_rand(&seed));
+		}
+
+		printf("\nstereo, %lu frames, ns/frame (speedup over the old loop)\n", frames);
+		old_f = time_it(frames, [&]() {
+			std::vector<float> a, b;
+			old_float(fbuf, 2, a, b);
+		});
+		old_s = time_it(frames, [&]() {
+			std::vector<float> a, b;
+			old_s16(sbuf, 2, a, b);
+		});
+		printf("  %-6s float %6.2f        s16 %6.2f\n", "old", old_f, old_s);
+		for(const kernel_t& k : ks) {
+			printf("  %-6s", k.name);
+			t = time_it(frames, [&]() { k.f(dst, 2, &fbuf[0], 2, frames); });
+			printf(" float %6.2f (%4.1fx)", t, old_f / t);
+			t = time_it(frames, [&]() { k.s(dst, 2, &sbuf[0], 2, frames); });
+			printf(" s16 %6.2f (%4.1fx)\n", t, old_s / t);
+		}
+	}
+
+} // anonymous namespace
+
+int main(int argc, char* argv[])
+{
+	std::vector<kernel_t> ks = kernels();
+	int rv = check(ks);
+
+	if( rv == 0 && !(argc > 1 && strcmp(argv[1], "--check") == 0) ) {
+		bench(ks);
+	}
+	return rv;
+}
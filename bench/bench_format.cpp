@@ -0,0 +1,356 @@
+/*
+ * Copyright(c) 2010 by Gabriel M. Beddingfield <gabriel@teuton.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY, without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+/* Checks the stereo output kernels in bams_format.c bit for bit
+ * against the conversions they replace, and times both over the
+ * usual period sizes.  For s16 that is jack's float_16(), via
+ * bams_copy_s16*_float*() once per channel with a stride of 2.  For
+ * float it is a scalar interleave plus bams_byte_reorder_in_place().
+ *
+ *   bench_format [--check]
+ *
+ * With --check only the check runs.  That is what ctest runs.
+ */
+
+// jack_memops.h has no C++ guard of its own.
+extern "C" {
+#include "jack_memops.h"
+}
+// The kernels are static, so include them.
+#include "bams_format.c"
+#include "bench_util.h"
+
+#include <vector>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+	struct kernel_t {
+		const char *name;
+		bams_s16_stereo_kernel_t s16;
+		bams_float_stereo_kernel_t flt;
+	};
+
+	std::vector<kernel_t> kernels()
+	{
+		std::vector<kernel_t> k;
+
+		k.push_back( kernel_t{"scalar", bams_s16_stereo_scalar, bams_float_stereo_scalar} );
+#if defined(__SSE2__)
+		k.push_back( kernel_t{"sse2", bams_s16_stereo_sse2, bams_float_stereo_sse2} );
+#endif
+#if defined(BAMS_HAVE_AVX2)
+		__builtin_cpu_init();
+		if( __builtin_cpu_supports("avx2") )
+			k.push_back( kernel_t{"avx2", bams_s16_stereo_avx2, bams_float_stereo_avx2} );
+#endif
+#if defined(__ARM_NEON) && defined(__aarch64__)
+		k.push_back( kernel_t{"neon", bams_s16_stereo_neon, bams_float_stereo_neon} );
+#endif
+		return k;
+	}
+
+	typedef void (*s16_stereo_t)(int16_t *dst, const float *left,
+				     const float *right, unsigned long count);
+	typedef void (*s16_old_t)(int16_t *dst, int dst_stride, float *src,
+				  int src_stride, unsigned long count);
+
+	/* One byte order.  The old per-channel functions only take
+	 * host order floats, so the swapped source orders are checked
+	 * against the same conversion of the unswapped input.
+	 */
+	struct order_t {
+		const char *name;
+		s16_stereo_t stereo;
+		s16_old_t old;
+		bool swap_src;
+	};
+
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+	const order_t s16_orders[] = {
+		{ "s16le_floatle", bams_copy_s16le_floatle_stereo, bams_copy_s16le_floatle, false },
+		{ "s16be_floatle", bams_copy_s16be_floatle_stereo, bams_copy_s16be_floatle, false },
+		{ "s16le_floatbe", bams_copy_s16le_floatbe_stereo, bams_copy_s16le_floatle, true },
+		{ "s16be_floatbe", bams_copy_s16be_floatbe_stereo, bams_copy_s16be_floatle, true },
+	};
+#else
+	const order_t s16_orders[] = {
+		{ "s16le_floatle", bams_copy_s16le_floatle_stereo, bams_copy_s16le_floatbe, true },
+		{ "s16be_floatle", bams_copy_s16be_floatle_stereo, bams_copy_s16be_floatbe, true },
+		{ "s16le_floatbe", bams_copy_s16le_floatbe_stereo, bams_copy_s16le_floatbe, false },
+		{ "s16be_floatbe", bams_copy_s16be_floatbe_stereo, bams_copy_s16be_floatbe, false },
+	};
+#endif
+
+	typedef void (*float_stereo_t)(float *dst, const float *left,
+				       const float *right, unsigned long count);
+
+	struct float_order_t {
+		const char *name;
+		float_stereo_t stereo;
+		bool swap;
+	};
+
+	const float_order_t float_orders[] = {
+		{ "floatle_floatle", bams_copy_floatle_floatle_stereo, false },
+		{ "floatbe_floatle", bams_copy_floatbe_floatle_stereo, true },
+		{ "floatle_floatbe", bams_copy_floatle_floatbe_stereo, true },
+		{ "floatbe_floatbe", bams_copy_floatbe_floatbe_stereo, false },
+	};
+
+	/* What _convert_to_output_float did before */
+	void old_float(float *dst, const float *left, const float *right,
+		       unsigned long count, bool swap)
+	{
+		float *out = dst;
+		unsigned long n = count;
+
+		while(n--) {
+			(*out++) = (*left++);
+			(*out++) = (*right++);
+		}
+		if(swap)
+			bams_byte_reorder_in_place(dst, 4, 1, 2*count);
+	}
+
+	float swapped(float f)
+	{
+		uint32_t u;
+		memcpy(&u, &f, sizeof(u));
+		u = __builtin_bswap32(u);
+		memcpy(&f, &u, sizeof(f));
+		return f;
+	}
+
+	/* Samples that are hard to get right: rounding halfway
+	 * points (and their neighbours), the clip points, values
+	 * past them, infinities, NaN, signed zero and denormals.
+	 * Random values fill the rest.
+	 */
+	std::vector<float> inputs(unsigned long n)
+	{
+		static const float specials[] = {
+			0.0f, -0.0f, 1.0f, -1.0f, 1.5f, -1.5f, 1e30f, -1e30f,
+			INFINITY, -INFINITY, NAN, -NAN, 1e-40f, -1e-40f,
+			0.5f / 32767.0f, -0.5f / 32767.0f,
+			1.5f / 32767.0f, -1.5f / 32767.0f,
+			32766.5f / 32767.0f, -32766.5f / 32767.0f,
+		};
+		const size_t n_specials = sizeof(specials) / sizeof(specials[0]);
+		std::vector<float> v;
+		uint32_t seed = 3;
+		float h;
+
+		for(size_t k = 0 ; k < n_specials ; ++k)
+			v.push_back(specials[k]);
+		v.push_back( nextafterf(1.0f, 0.0f) );
+		v.push_back( -nextafterf(1.0f, 0.0f) );
+		while( v.size() < n ) {
+			h = (float(int(bench_rand(&seed) % 65535) - 32767) + 0.5f) / 32767.0f;
+			v.push_back( h );
+			v.push_back( nextafterf(h, 2.0f) );
+			v.push_back( nextafterf(h, -2.0f) );
+			v.push_back( bench_rand_float(&seed, 1.25f) );
+		}
+		v.resize(n);
+		return v;
+	}
+
+	int check_s16(const std::vector<kernel_t>& ks)
+	{
+		const unsigned long max_frames = 70;
+		std::vector<float> in = inputs(1 << 14), in_swapped(in.size());
+		std::vector<int16_t> ref(2 * max_frames), out(2 * max_frames + 1);
+		bams_s16_stereo_kernel_t chosen = bams_s16_stereo;
+		int failures = 0;
+
+		for(size_t k = 0 ; k < in.size() ; ++k)
+			in_swapped[k] = swapped(in[k]);
+
+		for(const kernel_t& k : ks) {
+			bams_s16_stereo = k.s16;
+			for(const order_t& o : s16_orders) {
+				const std::vector<float>& src = o.swap_src ? in_swapped : in;
+				for(unsigned long frames = 0 ; frames <= max_frames ; ++frames) {
+					for(size_t pos = 0 ; pos + 2 * frames <= in.size() ; pos += 2 * frames + 1) {
+						const float *l = &in[pos], *r = &in[pos + frames];
+						o.old(&ref[0], 2, const_cast<float*>(l), 1, frames);
+						o.old(&ref[1], 2, const_cast<float*>(r), 1, frames);
+						out.assign(out.size(), 0x5a5a);
+						o.stereo(&out[0], &src[pos], &src[pos + frames], frames);
+						if( memcmp(&ref[0], &out[0], 2 * frames * sizeof(int16_t))
+						    || out[2 * frames] != 0x5a5a ) {
+							printf("FAIL %s %s frames=%lu pos=%lu\n",
+							       k.name, o.name, frames, (unsigned long)pos);
+							++failures;
+							break;
+						}
+					}
+				}
+			}
+		}
+		bams_s16_stereo = chosen;
+		return failures;
+	}
+
+	/* Float output only moves bits around, so any pattern will do:
+	 * random words (NaNs with payloads among them) plus the
+	 * special values.
+	 */
+	int check_float(const std::vector<kernel_t>& ks)
+	{
+		const unsigned long max_frames = 70;
+		std::vector<float> in = inputs(1 << 12);
+		std::vector<float> ref(2 * max_frames), out(2 * max_frames + 1);
+		bams_float_stereo_kernel_t chosen = bams_float_stereo;
+		const float guard = -99.0f;
+		uint32_t seed = 5, u;
+		int failures = 0;
+
+		for(size_t k = 0 ; k < in.size() ; k += 2) {
+			u = bench_rand(&seed);
+			memcpy(&in[k], &u, sizeof(u));
+		}
+
+		for(const kernel_t& k : ks) {
+			bams_float_stereo = k.flt;
+			for(const float_order_t& o : float_orders) {
+				for(unsigned long frames = 0 ; frames <= max_frames ; ++frames) {
+					for(size_t pos = 0 ; pos + 2 * frames <= in.size() ; pos += 2 * frames + 1) {
+						const float *l = &in[pos], *r = &in[pos + frames];
+						old_float(&ref[0], l, r, frames, o.swap);
+						out.assign(out.size(), guard);
+						o.stereo(&out[0], l, r, frames);
+						if( memcmp(&ref[0], &out[0], 2 * frames * sizeof(float))
+						    || memcmp(&out[2 * frames], &guard, sizeof(float)) ) {
+							printf("FAIL %s %s frames=%lu pos=%lu\n",
+							       k.name, o.name, frames, (unsigned long)pos);
+							++failures;
+							break;
+						}
+					}
+				}
+			}
+		}
+		bams_float_stereo = chosen;
+		return failures;
+	}
+
+	int check(const std::vector<kernel_t>& ks)
+	{
+		int failures = check_s16(ks) + check_float(ks);
+
+		printf("format check: %s\n", failures ? "FAILED" : "ok");
+		return failures ? 1 : 0;
+	}
+
+	/* ns per stereo frame: the best of a few runs, each converting
+	 * about a million frames one period at a time.
+	 */
+	template <typename Fn>
+	double time_it(unsigned long period, Fn fn)
+	{
+		const unsigned long periods = (1UL << 20) / period;
+		double best = 1e9;
+		for(int run = 0 ; run < 5 ; ++run) {
+			double t = bench_now();
+			for(unsigned long p = 0 ; p < periods ; ++p)
+				fn();
+			t = bench_now() - t;
+			if( t < best ) best = t;
+		}
+		return best * 1e9 / (periods * period);
+	}
+
+	/* The host order s16 and float conversions ALSA uses, native
+	 * and byte swapped.
+	 */
+	void bench(const std::vector<kernel_t>& ks)
+	{
+		const unsigned long max_period = 8192;
+		std::vector<float> l(max_period), r(max_period);
+		std::vector<int16_t> s16(2 * max_period);
+		std::vector<float> flt(2 * max_period);
+		bams_s16_stereo_kernel_t chosen_s16 = bams_s16_stereo;
+		bams_float_stereo_kernel_t chosen_float = bams_float_stereo;
+		uint32_t seed = 7;
+		int o;
+
+		for(unsigned long k = 0 ; k < max_period ; ++k) {
+			l[k] = bench_rand_float(&seed, 1.0f);
+			r[k] = bench_rand_float(&seed, 1.0f);
+		}
+
+		printf("\nns/frame by period (speedup over the old conversion)\n");
+		for(o = 0 ; o < 4 ; ++o) {
+			const order_t& so = s16_orders[(BAMS_SWAP_FLOATLE ? 2 : 0) + (o & 1)];
+			const float_order_t& fo = float_orders[(BAMS_SWAP_FLOATLE ? 2 : 0) + (o & 1)];
+			bool is_s16 = (o < 2);
+
+			printf("\n  %-16s %8s", is_s16 ? so.name : fo.name, "old");
+			for(const kernel_t& k : ks)
+				printf(" %13s", k.name);
+			printf("\n");
+			for(unsigned long period = 64 ; period <= max_period ; period *= 2) {
+				double old, t;
+				if( is_s16 ) {
+					old = time_it(period, [&]() {
+						so.old(&s16[0], 2, &l[0], 1, period);
+						so.old(&s16[1], 2, &r[0], 1, period);
+					});
+				} else {
+					old = time_it(period, [&]() {
+						old_float(&flt[0], &l[0], &r[0], period, fo.swap);
+					});
+				}
+				printf("  %16lu %8.3f", period, old);
+				for(const kernel_t& k : ks) {
+					if( is_s16 ) {
+						bams_s16_stereo = k.s16;
+						t = time_it(period, [&]() {
+							so.stereo(&s16[0], &l[0], &r[0], period);
+						});
+					} else {
+						bams_float_stereo = k.flt;
+						t = time_it(period, [&]() {
+							fo.stereo(&flt[0], &l[0], &r[0], period);
+						});
+					}
+					printf(" %6.3f (%4.1fx)", t, old / t);
+				}
+				printf("\n");
+			}
+		}
+		bams_s16_stereo = chosen_s16;
+		bams_float_stereo = chosen_float;
+	}
+
+} // anonymous namespace
+
+int main(int argc, char* argv[])
+{
+	std::vector<kernel_t> ks = kernels();
+	int rv = check(ks);
+
+	if( rv == 0 && !(argc > 1 && strcmp(argv[1], "--check") == 0) ) {
+		bench(ks);
+	}
+	return rv;
+}
@@ -0,0 +1,223 @@
+/*
+ * Copyright(c) 2010 by Gabriel M. Beddingfield <gabriel@teuton.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY, without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+/* Checks the bams_pack kernels bit for bit against the generic
+ * versions, and times them.
+ *
+ *   bench_pack [--check]
+ *
+ * With --check only the check runs.  That is what ctest runs.
+ */
+
+// The kernels are static, so include them.
+#include "bams_pack.c"
+#include "bench_util.h"
+
+#include <vector>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+	struct kernel_t {
+		const char *name;
+		pack_s16_t s16;       // 0 if this CPU can't run it
+		pack_f16_t f16;
+		unpack_f16_t unf16;
+	};
+
+	std::vector<kernel_t> kernels()
+	{
+		std::vector<kernel_t> k;
+
+		k.push_back( kernel_t{"c", pack_s16_c, pack_f16_c, unpack_f16_c} );
+#ifdef BAMS_X86_SIMD
+		__builtin_cpu_init();
+		if( __builtin_cpu_supports("sse2") )
+			k.push_back( kernel_t{"sse2", pack_s16_sse2, 0, 0} );
+		if( __builtin_cpu_supports("avx2") )
+			k.push_back( kernel_t{"avx2", pack_s16_avx2, 0, 0} );
+		if( __builtin_cpu_supports("avx") && __builtin_cpu_supports("f16c") )
+			k.push_back( kernel_t{"f16c", 0, pack_f16_f16c, unpack_f16_f16c} );
+#endif
+		return k;
+	}
+
+	float from_bits(uint32_t u)
+	{
+		float f;
+		memcpy(&f, &u, sizeof(f));
+		return f;
+	}
+
+	/* Floats that are hard to round: for every half, the point
+	 * halfway to the next one and its neighbours.  For s16, the
+	 * same around every integer step.  Then the clip points,
+	 * infinities, NaNs (quiet and signalling, with payloads),
+	 * signed zero, denormals and random bit patterns.
+	 */
+	std::vector<float> inputs()
+	{
+		std::vector<float> v;
+		uint32_t seed = 11;
+		float h, next, mid;
+		int k;
+
+		for(k = 0 ; k < 0x7c00 ; ++k) {
+			h = half_to_float(k);
+			next = half_to_float(k + 1);
+			mid = h + (next - h) / 2;
+			for(float f : { mid, nextafterf(mid, 0.0f), nextafterf(mid, 1e9f) }) {
+				v.push_back(f);
+				v.push_back(-f);
+			}
+		}
+		for(k = -32769 ; k <= 32768 ; ++k) {
+			mid = (k + 0.5f) / S16_SCALING;
+			v.push_back(mid);
+			v.push_back(nextafterf(mid, -2.0f));
+			v.push_back(nextafterf(mid, 2.0f));
+		}
+		for(float f : { 0.0f, -0.0f, 1.0f, -1.0f, 2.0f, -2.0f, 65504.0f, 65520.0f,
+				1e30f, -1e30f, INFINITY, -INFINITY, 1e-40f, -1e-40f }) {
+			v.push_back(f);
+		}
+		for(uint32_t u : { 0x7fc00000u, 0xffc00000u, 0x7f800001u, 0xff800001u,
+				   0x7fa00000u, 0x7fbfffffu, 0x7fc01234u, 0x00000001u }) {
+			v.push_back(from_bits(u));
+		}
+		for(k = 0 ; k < (1 << 18) ; ++k) {
+			v.push_back(from_bits(bench_rand(&seed)));
+			v.push_back(bench_rand_float(&seed, 1.25f));
+		}
+		return v;
+	}
+
+	/* Run a kernel at every offset and length below 40 (to cover
+	 * the tails and unaligned starts), then over the whole input.
+	 */
+	template <typename In, typename Out, typename Fn>
+	bool same(Fn ref, Fn fn, const std::vector<In>& in)
+	{
+		std::vector<Out> a(in.size() + 1), b(in.size() + 1);
+		unsigned long pos, n;
+
+		for(pos = 0 ; pos < 40 ; ++pos) {
+			for(n = 0 ; n < 40 ; ++n) {
+				memset(&a[0], 0x5a, a.size() * sizeof(Out));
+				memset(&b[0], 0x5a, b.size() * sizeof(Out));
+				ref(&a[0], &in[pos], n);
+				fn(&b[0], &in[pos], n);
+				if( memcmp(&a[0], &b[0], (n + 1) * sizeof(Out)) )
+					return false;
+			}
+		}
+		ref(&a[0], &in[0], in.size());
+		fn(&b[0], &in[0], in.size());
+		return memcmp(&a[0], &b[0], a.size() * sizeof(Out)) == 0;
+	}
+
+	int check(const std::vector<kernel_t>& ks)
+	{
+		std::vector<float> in = inputs();
+		std::vector<uint16_t> halves(1 << 16);
+		int failures = 0;
+
+		for(size_t k = 0 ; k < halves.size() ; ++k)
+			halves[k] = k;
+
+		for(const kernel_t& k : ks) {
+			if( k.s16 && !same<float, int16_t>(pack_s16_c, k.s16, in) ) {
+				printf("FAIL pack_s16 %s\n", k.name);
+				++failures;
+			}
+			if( k.f16 && !same<float, uint16_t>(pack_f16_c, k.f16, in) ) {
+				printf("FAIL pack_f16 %s\n", k.name);
+				++failures;
+			}
+			if( k.unf16 && !same<uint16_t, float>(unpack_f16_c, k.unf16, halves) ) {
+				printf("FAIL unpack_f16 %s\n", k.name);
+				++failures;
+			}
+		}
+		printf("pack check: %s\n", failures ? "FAILED" : "ok");
+		return failures ? 1 : 0;
+	}
+
+	/* ns per sample, best of a few runs */
+	template <typename Fn>
+	double time_it(unsigned long count, Fn fn)
+	{
+		double best = 1e9;
+		for(int run = 0 ; run < 5 ; ++run) {
+			double t = bench_now();
+			fn();
+			t = bench_now() - t;
+			if( t < best ) best = t;
+		}
+		return best * 1e9 / count;
+	}
+
+	void bench(const std::vector<kernel_t>& ks)
+	{
+		const unsigned long count = 1UL << 21;
+		std::vector<float> f(count), g(count);
+		std::vector<int16_t> s(count);
+		std::vector<uint16_t> h(count);
+		uint32_t seed = 7;
+		double c_s16 = 0, c_f16 = 0, c_unf16 = 0, t;
+
+		for(size_t k = 0 ; k < count ; ++k)
+			f[k] = bench_rand_float(&seed, 1.0f);
+		pack_f16_c(&h[0], &f[0], count);
+
+		printf("\n%lu samples, ns/sample (speedup over c)\n", count);
+		for(const kernel_t& k : ks) {
+			printf("  %-6s", k.name);
+			if( k.s16 ) {
+				t = time_it(count, [&]() { k.s16(&s[0], &f[0], count); });
+				if( !c_s16 ) c_s16 = t;
+				printf(" pack_s16 %6.3f (%4.1fx)", t, c_s16 / t);
+			}
+			if( k.f16 ) {
+				t = time_it(count, [&]() { k.f16(&h[0], &f[0], count); });
+				if( !c_f16 ) c_f16 = t;
+				printf(" pack_f16 %6.3f (%4.1fx)", t, c_f16 / t);
+			}
+			if( k.unf16 ) {
+				t = time_it(count, [&]() { k.unf16(&g[0], &h[0], count); });
+				if( !c_unf16 ) c_unf16 = t;
+				printf(" unpack_f16 %6.3f (%4.1fx)", t, c_unf16 / t);
+			}
+			printf("\n");
+		}
+	}
+
+} // anonymous namespace
+
+int main(int argc, char* argv[])
+{
+	std::vector<kernel_t> ks = kernels();
+	int rv = check(ks);
+
+	if( rv == 0 && !(argc > 1 && strcmp(argv[1], "--check") == 0) ) {
+		bench(ks);
+	}
+	return rv;
+}
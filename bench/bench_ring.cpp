@@ -0,0 +1,230 @@
+/*
+ * Copyright(c) 2010 by Gabriel M. Beddingfield <gabriel@teuton.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY, without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/* Checks MultiRingBuffer across two threads, and compares its
+ * throughput with a pair of Tritium::RingBuffer's (one per
+ * channel, as RubberBandServer used before).
+ *
+ *   bench_ring [--check]
+ *
+ * With --check only the check runs.  That is what ctest runs.
+ */
+
+#include "MultiRingBuffer.hpp"
+#include "RingBuffer.hpp"
+#include "bench_util.h"
+
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+
+using namespace StretchPlayer;
+
+namespace
+{
+	const unsigned CAPACITY = 1 << 16;
+	typedef MultiRingBuffer<float, 2, CAPACITY> multi_t;
+	typedef Tritium::RingBuffer<float> tritium_t;
+
+	/* The old layout: one ring per channel.  Right is written
+	 * last, so its read space is what both have.
+	 */
+	struct pair_t {
+		tritium_t left, right;
+		pair_t() : left(CAPACITY), right(CAPACITY) {}
+		unsigned write(float **src, unsigned cnt) {
+			unsigned n = right.write_space();
+			if( cnt > n ) cnt = n;
+			left.write(src[0], cnt);
+			right.write(src[1], cnt);
+			return cnt;
+		}
+		unsigned read(float **dst, unsigned cnt) {
+			unsigned n = right.read_space();
+			if( cnt > n ) cnt = n;
+			left.read(dst[0], cnt);
+			right.read(dst[1], cnt);
+			return cnt;
+		}
+	};
+
+	unsigned ring_write(multi_t& rb, float **src, unsigned cnt) {
+		return rb.write(src, cnt);
+	}
+	unsigned ring_write(pair_t& rb, float **src, unsigned cnt) {
+		return rb.write(src, cnt);
+	}
+	unsigned ring_read(multi_t& rb, float **dst, unsigned cnt) {
+		return rb.read(dst, cnt);
+	}
+	unsigned ring_read(pair_t& rb, float **dst, unsigned cnt) {
+		return rb.read(dst, cnt);
+	}
+
+	/* Frame k is (k, -k), modulo a range floats hold exactly. */
+	inline float frame_value(unsigned long k) {
+		return float(k & 0xFFFFF);
+	}
+
+	/**
+	 * Stream frames through the ring from a producer thread to
+	 * this one, block frames at a time.  Without verify, the frames
+	 * aren't filled in or checked, so only the ring is timed.
+	 *
+	 * \return false if any frame came out wrong
+	 */
+	template <typename Ring>
+	bool transfer(Ring& rb, unsigned long frames, unsigned block, bool verify)
+	{
+		std::thread producer([&rb, frames, block, verify]() {
+			std::vector<float> l(block), r(block);
+			float *src[2] = { &l[0], &r[0] };
+			unsigned long k = 0;
+			while( k < frames ) {
+				unsigned n = block;
+				if( n > frames - k ) n = frames - k;
+				for(unsigned j = 0 ; verify && j < n ; ++j) {
+					l[j] = frame_value(k + j);
+					r[j] = -frame_value(k + j);
+				}
+				unsigned done = 0;
+				while( done < n ) {
+					float *s[2] = { src[0] + done, src[1] + done };
+					unsigned w = ring_write(rb, s, n - done);
+					if( w == 0 ) std::this_thread::yield();
+					done += w;
+				}
+				k += n;
+			}
+		});
+
+		std::vector<float> l(block), r(block);
+		float *dst[2] = { &l[0], &r[0] };
+		unsigned long k = 0;
+		bool ok = true;
+		while( k < frames ) {
+			unsigned n = ring_read(rb, dst, block);
+			if( n == 0 ) {
+				std::this_thread::yield();
+				continue;
+			}
+			for(unsigned j = 0 ; verify && j < n ; ++j) {
+				if( l[j] != frame_value(k + j) || r[j] != -frame_value(k + j) )
+					ok = false;
+			}
+			k += n;
+		}
+		producer.join();
+		return ok;
+	}
+
+	int check()
+	{
+		static const unsigned blocks[] = { 1, 7, 256, 4096, CAPACITY };
+		std::unique_ptr<multi_t> rb(new multi_t);
+		int failures = 0;
+
+		for(unsigned block : blocks) {
+			if( !transfer(*rb, 1UL << 20, block, true) ) {
+				printf("FAIL transfer block=%u\n", block);
+				++failures;
+			}
+		}
+
+		/* discard_to() drops what was written before the mark,
+		 * and nothing after it.
+		 */
+		{
+			float a[2][100], b[2][100];
+			float *src[2] = { a[0], a[1] }, *dst[2] = { b[0], b[1] };
+			unsigned mark;
+
+			for(int k = 0 ; k < 100 ; ++k) {
+				a[0][k] = k;
+				a[1][k] = -k;
+			}
+			rb->write(src, 60);
+			rb->read(dst, 10);
+			mark = rb->write_idx();
+			rb->write(src, 40);
+			rb->discard_to(mark);
+			if( rb->read_space() != 40 || rb->read(dst, 100) != 40 || b[0][0] != 0 ) {
+				printf("FAIL discard_to\n");
+				++failures;
+			}
+			rb->write(src, 30);
+			rb->discard();
+			if( rb->read_space() != 0 || rb->read(dst, 100) != 0 ) {
+				printf("FAIL discard\n");
+				++failures;
+			}
+		}
+
+		printf("ring check: %s\n", failures ? "FAILED" : "ok");
+		return failures ? 1 : 0;
+	}
+
+	/* Mframes/sec, best of a few runs */
+	template <typename Ring>
+	double throughput(Ring& rb, unsigned block)
+	{
+		const unsigned long frames = 1UL << 24;
+		double best = 0, t;
+
+		for(int run = 0 ; run < 3 ; ++run) {
+			t = bench_now();
+			transfer(rb, frames, block, false);
+			t = frames / (bench_now() - t) / 1e6;
+			if( t > best ) best = t;
+		}
+		return best;
+	}
+
+	void bench()
+	{
+		static const unsigned blocks[] = { 64, 256, 1024, 4096 };
+		std::unique_ptr<multi_t> multi(new multi_t);
+		std::unique_ptr<pair_t> pair(new pair_t);
+		double m, p;
+
+		printf("\nstereo, producer and consumer threads, Mframes/sec\n");
+		if( std::thread::hardware_concurrency() < 2 ) {
+			printf("(one CPU: the threads take turns, so there is no\n"
+			       " cache line traffic between them to measure)\n");
+		}
+		printf("  %6s %16s %16s\n", "block", "RingBuffer pair", "MultiRingBuffer");
+		for(unsigned block : blocks) {
+			p = throughput(*pair, block);
+			m = throughput(*multi, block);
+			printf("  %6u %16.1f %16.1f (%.1fx)\n", block, p, m, m / p);
+		}
+	}
+
+} // anonymous namespace
+
+int main(int argc, char* argv[])
+{
+	int rv = check();
+
+	if( rv == 0 && !(argc > 1 && strcmp(argv[1], "--check") == 0) ) {
+		bench();
+	}
+	return rv;
+}
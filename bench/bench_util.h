@@ -0,0 +1,55 @@
+/*
+ * Copyright(c) 2010 by Gabriel M. Beddingfield <gabriel@teuton.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY, without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+#ifndef BENCH_UTIL_H
+#define BENCH_UTIL_H
+
+/* Helpers shared by the checks and benchmarks in this directory.
+ */
+
+#include <stdint.h>
+#include <time.h>
+
+/* Seconds on a monotonic clock */
+static inline double
+bench_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Repeatable pseudo-random numbers (xorshift32) */
+static inline uint32_t
+bench_rand(uint32_t *state)
+{
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *state = x;
+}
+
+/* Uniform in [-scale, scale) */
+static inline float
+bench_rand_float(uint32_t *state, float scale)
+{
+	return scale * ((float)(bench_rand(state) >> 8) / 8388608.0f - 1.0f);
+}
+
+#endif /* BENCH_UTIL_H */
@@ -35,6 +35,7 @@
 #include <alsa/asoundlib.h>
 #include <sys/time.h>
 #include <cmath>
+#include <unistd.h>
 
 #include "bams_format.h"
 #include <endian.h>
@@ -42,45 +43,140 @@
 #include <iostream>
 using namespace std;
 
-/* Formats supported by this class, in order or preference
- */
-static const snd_pcm_format_t aas_supported_formats[] = {
+namespace StretchPlayer
+{
+	inline bool not_aligned_16(void* ptr) {
+	return (reinterpret_cast<uintptr_t>(ptr) & 0x0F);
+	}
+
+	enum { AAS_INT, AAS_UINT, AAS_FLOAT };
+
+	/* The stretcher's output is always host order floats.
+	 */
 #if __BYTE_ORDER == __LITTLE_ENDIAN
-	SND_PCM_FORMAT_FLOAT_LE,
-	SND_PCM_FORMAT_S16_LE,
-	SND_PCM_FORMAT_FLOAT_BE,
-	SND_PCM_FORMAT_S16_BE,
-	SND_PCM_FORMAT_U16_LE,
-	SND_PCM_FORMAT_U16_BE,
+#define AAS_FROM_HOST(fn, suffix) fn ## _floatle ## suffix
 #elif __BYTE_ORDER == __BIG_ENDIAN
-	SND_PCM_FORMAT_FLOAT_BE,
-	SND_PCM_FORMAT_S16_BE,
-	SND_PCM_FORMAT_FLOAT_LE,
-	SND_PCM_FORMAT_S16_LE,
-	SND_PCM_FORMAT_U16_BE,
-	SND_PCM_FORMAT_U16_LE,
+#define AAS_FROM_HOST(fn, suffix) fn ## _floatbe ## suffix
 #else
 #error Unsupport byte order.
 #endif
-	SND_PCM_FORMAT_UNKNOWN
-};
 
-namespace StretchPlayer
-{
-	inline bool not_aligned_16(void* ptr) {
-	return (reinterpret_cast<uintptr_t>(ptr) & 0x0F);
+	/* 24 and 32 bit: one channel at a time, each with its own
+	 * dither state.
+	 */
+#define AAS_COPY_S24(d)								\
+	if(Dither) {								\
+		AAS_FROM_HOST(bams_copy_ ## d, _dither)((bams_sample_ ## d ## _t*)dst, 2, \
+							(float*)left, 1, nframes, &dither[0]); \
+		AAS_FROM_HOST(bams_copy_ ## d, _dither)((bams_sample_ ## d ## _t*)dst + 1, 2, \
+							(float*)right, 1, nframes, &dither[1]); \
+	} else {								\
+		AAS_FROM_HOST(bams_copy_ ## d, )((bams_sample_ ## d ## _t*)dst, 2, \
+						 (float*)left, 1, nframes);	\
+		AAS_FROM_HOST(bams_copy_ ## d, )((bams_sample_ ## d ## _t*)dst + 1, 2, \
+						 (float*)right, 1, nframes);	\
+	}
+
+	/**
+	 * \brief Convert and interleave nframes of left and right into
+	 * dst, in the device's format.
+	 *
+	 * Every format is an instance of this.  The tests are all on
+	 * template parameters, so each instance compiles down to the
+	 * one conversion it needs.  [RT SAFE]
+	 */
+	template <int Type, unsigned Bits, unsigned Bytes, bool LittleEndian, bool Dither>
+	void aas_convert(void *dst, const float *left, const float *right,
+			 uint32_t nframes, dither_state_t *dither)
+	{
+	if(Type == AAS_FLOAT) {
+		assert(Bits == 32 && Bytes == 4);
+		if(LittleEndian) {
+		AAS_FROM_HOST(bams_copy_floatle, _stereo)((bams_sample_floatle_t*)dst, left, right, nframes);
+		} else {
+		AAS_FROM_HOST(bams_copy_floatbe, _stereo)((bams_sample_floatbe_t*)dst, left, right, nframes);
+		}
+	} else if(Bits == 16) {
+		assert(Bytes == 2);
+		if(LittleEndian) {
+		AAS_FROM_HOST(bams_copy_s16le, _stereo)((bams_sample_s16le_t*)dst, left, right, nframes);
+		} else {
+		AAS_FROM_HOST(bams_copy_s16be, _stereo)((bams_sample_s16be_t*)dst, left, right, nframes);
+		}
+		if(Type == AAS_UINT) {
+		// Flip the sign bit, in the byte that holds it.
+		unsigned char *b = (unsigned char*)dst + (LittleEndian ? 1 : 0);
+		uint32_t k;
+		for(k = 0 ; k < 2 * nframes ; ++k, b += 2) {
+			(*b) ^= 0x80;
+		}
+		}
+	} else if(Bits == 24 && Bytes == 3) {
+		assert(Type == AAS_INT && LittleEndian);
+		AAS_COPY_S24(s24le3);
+	} else if(Bits == 24) {
+		assert(Type == AAS_INT && LittleEndian && Bytes == 4);
+		AAS_COPY_S24(s24le4);
+	} else {
+		assert(Type == AAS_INT && LittleEndian && Bits == 32 && Bytes == 4);
+		AAS_COPY_S24(s32le);
 	}
+	}
+
+#undef AAS_COPY_S24
+
+	typedef struct _aas_format_t
+	{
+	snd_pcm_format_t format;
+	unsigned bytes; // per sample
+	AlsaAudioSystem::convert_t convert;
+	AlsaAudioSystem::convert_t convert_dither;
+	} aas_format_t;
+
+#define AAS_FORMAT(format, type, bits, bytes, le)				\
+	{ format, bytes,							\
+	  aas_convert<type, bits, bytes, le, false>,				\
+	  aas_convert<type, bits, bytes, le, true> }
+
+	/* Formats supported by this class, in order of preference.
+	 * To add a format, add it here (and to aas_convert() if it
+	 * needs a new conversion).
+	 */
+	static const aas_format_t aas_formats[] = {
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+	AAS_FORMAT(SND_PCM_FORMAT_FLOAT_LE, AAS_FLOAT, 32, 4, true),
+	AAS_FORMAT(SND_PCM_FORMAT_S32_LE,   AAS_INT,   32, 4, true),
+	AAS_FORMAT(SND_PCM_FORMAT_S24_LE,   AAS_INT,   24, 4, true),
+	AAS_FORMAT(SND_PCM_FORMAT_S24_3LE,  AAS_INT,   24, 3, true),
+	AAS_FORMAT(SND_PCM_FORMAT_S16_LE,   AAS_INT,   16, 2, true),
+	AAS_FORMAT(SND_PCM_FORMAT_FLOAT_BE, AAS_FLOAT, 32, 4, false),
+	AAS_FORMAT(SND_PCM_FORMAT_S16_BE,   AAS_INT,   16, 2, false),
+	AAS_FORMAT(SND_PCM_FORMAT_U16_LE,   AAS_UINT,  16, 2, true),
+	AAS_FORMAT(SND_PCM_FORMAT_U16_BE,   AAS_UINT,  16, 2, false),
+#else
+	AAS_FORMAT(SND_PCM_FORMAT_FLOAT_BE, AAS_FLOAT, 32, 4, false),
+	AAS_FORMAT(SND_PCM_FORMAT_S16_BE,   AAS_INT,   16, 2, false),
+	AAS_FORMAT(SND_PCM_FORMAT_FLOAT_LE, AAS_FLOAT, 32, 4, true),
+	AAS_FORMAT(SND_PCM_FORMAT_S32_LE,   AAS_INT,   32, 4, true),
+	AAS_FORMAT(SND_PCM_FORMAT_S24_LE,   AAS_INT,   24, 4, true),
+	AAS_FORMAT(SND_PCM_FORMAT_S24_3LE,  AAS_INT,   24, 3, true),
+	AAS_FORMAT(SND_PCM_FORMAT_S16_LE,   AAS_INT,   16, 2, true),
+	AAS_FORMAT(SND_PCM_FORMAT_U16_BE,   AAS_UINT,  16, 2, false),
+	AAS_FORMAT(SND_PCM_FORMAT_U16_LE,   AAS_UINT,  16, 2, true),
+#endif
+	{ SND_PCM_FORMAT_UNKNOWN, 0, 0, 0 }
+	};
+
+#undef AAS_FORMAT
 
 	AlsaAudioSystem::AlsaAudioSystem() :
 	_channels(2),
-	_type(FLOAT),
-	_bits(32),
-/*	_type(INT),
-	_bits(16), */
-	_little_endian(true),
+	_bytes(4),
+	_convert(0),
 	_sample_rate(44100),
 	_period_nframes(512),
 	_active(false),
+	_mmap(false),
 	_playback_handle(0),
 	_left_root(0),
 	_right_root(0),
@@ -90,12 +186,15 @@ namespace StretchPlayer
 	_callback_arg(0),
 	_dsp_load_pos(0),
 	_dsp_load(0.0f),
+	_xruns(0),
 	_d(0)
 	{
 	memset(&_dsp_a, 0, sizeof(timeval));
 	memset(&_dsp_b, 0, sizeof(timeval));
 	memset(_dsp_idle_time, 0, sizeof(_dsp_idle_time));
 	memset(_dsp_work_time, 0, sizeof(_dsp_work_time));
+	memset(_dither_state, 0, sizeof(_dither_state));
+	_dither_state[1].idx = 1; // independent noise per channel
 
 	_d = new AlsaAudioSystemPrivate();
 	_d->parent(this);
@@ -114,7 +213,7 @@ namespace StretchPlayer
 	unsigned nfrags;
 	int err;
 	snd_pcm_format_t format = SND_PCM_FORMAT_UNKNOWN;
-	int k;
+	const aas_format_t *fmt;
 
 	_sample_rate = config->sample_rate();
 	_period_nframes = config->period_size();
@@ -160,7 +259,12 @@ namespace StretchPlayer
 		goto init_bail;
 	}
 
-	if((err = snd_pcm_hw_params_set_access(_playback_handle, hw_params,
+	/* Prefer mmap, which lets _run() convert straight into the
+	 * device's buffer.
+	 */
+	_mmap = (snd_pcm_hw_params_set_access(_playback_handle, hw_params,
+					      SND_PCM_ACCESS_MMAP_INTERLEAVED) == 0);
+	if(!_mmap && (err = snd_pcm_hw_params_set_access(_playback_handle, hw_params,
 						   SND_PCM_ACCESS_RW_INTERLEAVED)) < 0) {
 		if (err_msg){
 			strcat(err_msg, "cannot set access type (");
@@ -170,55 +274,21 @@ namespace StretchPlayer
 		goto init_bail;
 	}
 
-	for(k = 0 ; aas_supported_formats[k] != SND_PCM_FORMAT_UNKNOWN ; ++k) {
-		format = aas_supported_formats[k];
-		if(snd_pcm_hw_params_test_format(_playback_handle, hw_params, format)) {
-		format = SND_PCM_FORMAT_UNKNOWN;
-		} else {
+	for(fmt = aas_formats ; fmt->format != SND_PCM_FORMAT_UNKNOWN ; ++fmt) {
+		if(snd_pcm_hw_params_test_format(_playback_handle, hw_params, fmt->format) == 0) {
 		break;
 		}
 	}
+	format = fmt->format;
 
-	switch(format) {
-	case SND_PCM_FORMAT_FLOAT_LE:
-		_type = FLOAT;
-		_bits = 32;
-		_little_endian = true;
-		break;
-	case SND_PCM_FORMAT_S16_LE:
-		_type = INT;
-		_bits = 16;
-		_little_endian = true;
-		break;
-	case SND_PCM_FORMAT_FLOAT_BE:
-		_type = FLOAT;
-		_bits = 32;
-		_little_endian = false;
-		break;
-	case SND_PCM_FORMAT_S16_BE:
-		_type = INT;
-		_bits = 16;
-		_little_endian = false;
-		break;
-	case SND_PCM_FORMAT_U16_LE:
-		_type = UINT;
-		_bits = 32;
-		_little_endian = true;
-		break;
-	case SND_PCM_FORMAT_U16_BE:
-		_type = UINT;
-		_bits = 32;
-		_little_endian = false;
-		break;
-	case SND_PCM_FORMAT_UNKNOWN:
+	if(format == SND_PCM_FORMAT_UNKNOWN) {
 		if (err_msg){
 			strcat(err_msg, "The audio card does not support any PCM audio formats that StretchPlayer supports");
 		}
 		goto init_bail;
-		break;
-	default:
-		assert(false);
 	}
+	_bytes = fmt->bytes;
+	_convert = config->dither() ? fmt->convert_dither : fmt->convert;
 
 	if((err = snd_pcm_hw_params_set_format(_playback_handle, hw_params, format)) < 0) {
 		if (err_msg){
@@ -329,13 +399,7 @@ namespace StretchPlayer
 
 	size_t data_size;
 
-	switch(_bits) {
-	case 8:  data_size = 1; break;
-	case 16: data_size = 2; break;
-	case 24: data_size = 4; break;
-	case 32: data_size = 4; break;
-	default: assert(false);
-	}
+	data_size = _bytes;
 
 	_buf = _buf_root = new unsigned short[_period_nframes * _channels * data_size + 16];
 	_left = _left_root = new float[_period_nframes + 4];
@@ -398,8 +462,12 @@ namespace StretchPlayer
 	assert(_left);
 	assert(_right);
 
+	if(_xrun_reporter.joinable())
+		_xrun_reporter.join(); // the last run may have bailed out
+
 	_active = true;
 	_d->start();
+	_xrun_reporter = std::thread(&AlsaAudioSystem::_report_xruns, this);
 
 	return 0;
 	}
@@ -409,6 +477,8 @@ namespace StretchPlayer
 	assert(_d);
 	_active = false;
 	_d->wait();
+	if(_xrun_reporter.joinable())
+		_xrun_reporter.join();
 	return 0;
 	}
 
@@ -548,7 +618,14 @@ namespace StretchPlayer
 		_stopwatch_start_work();
 		if((frames_to_deliver = snd_pcm_avail_update(_playback_handle)) < 0) {
 		if(frames_to_deliver == -EPIPE) {
-			/* An XRUN Occurred.  Ignoring. */
+			/* An XRUN Occurred.  Ignoring... but in mmap mode
+			 * nothing else would restart the device.
+			 */
+			if(_mmap && (err = _recover_xrun(frames_to_deliver)) < 0) {
+			err_msg = "Cannot recover from xrun [snd_pcm_recover()].";
+			str_err = snd_strerror(err);
+			goto run_bail;
+			}
 		} else {
 			err_msg = "Unknown ALSA snd_pcm_avail_update return value [snd_pcm_avail_update()].";
 			snprintf(misc_msg, misc_msg_size, "%ld", frames_to_deliver);
@@ -569,7 +646,23 @@ namespace StretchPlayer
 		goto run_bail;
 		}
 
-		_convert_to_output(frames_to_deliver);
+		if(_mmap) {
+		err = _write_mmap(frames_to_deliver);
+		if(err == -EPIPE || err == -ESTRPIPE) {
+			/* An XRUN Occurred.  The rest of the period is
+			 * dropped.
+			 */
+			err = _recover_xrun(err);
+		}
+		if(err < 0) {
+			err_msg = "Write to audio card failed [snd_pcm_mmap_commit()].";
+			str_err = snd_strerror(err);
+			goto run_bail;
+		}
+		continue;
+		}
+
+		_convert(_buf, _left, _right, frames_to_deliver, _dither_state);
 
 		/*if ((err = snd_pcm_drain(_playback_handle)) < 0)
 		{
@@ -606,104 +699,92 @@ namespace StretchPlayer
 	}
 
 	/**
-	 * \brief Convert, copy, and interleave _left and _right to _buf;
+	 * \brief Convert _left and _right straight into the device's
+	 * mmap'ed buffer.
+	 *
+	 * The buffer may wrap, so this can take more than one
+	 * begin/commit.  A short commit means the device overran the
+	 * buffer, and is reported like any other xrun.  Recovery is left
+	 * to the caller.
+	 *
+	 * \return 0 on success, -EPIPE or -ESTRPIPE on an xrun, or
+	 * another negative ALSA error code.
 	 */
-	void AlsaAudioSystem::_convert_to_output(uint32_t nframes)
+	int AlsaAudioSystem::_write_mmap(uint32_t nframes)
 	{
-	switch(_type) {
-	case INT: _convert_to_output_int(nframes); break;
-	case UINT: _convert_to_output_uint(nframes); break;
-	case FLOAT: _convert_to_output_float(nframes); break;
-	default: assert(false);
-	}
-	}
+	const snd_pcm_channel_area_t *areas;
+	snd_pcm_uframes_t offset, frames;
+	snd_pcm_sframes_t committed;
+	uint32_t pos = 0;
+	char *dst;
+	int err;
 
-	void AlsaAudioSystem::_convert_to_output_int(uint32_t nframes)
-	{
-	switch(_bits) {
-	case 16: {
-		bams_sample_s16le_t *dst = (bams_sample_s16le_t*)_buf;
-#if __BYTE_ORDER == __LITTLE_ENDIAN
-		if(_little_endian) {
-		bams_copy_s16le_floatle(dst, 2, &_left[0], 1, nframes);
-		bams_copy_s16le_floatle(dst+1, 2, &_right[0], 1, nframes);
-		} else {
-		bams_copy_s16be_floatle(dst, 2, &_left[0], 1, nframes);
-		bams_copy_s16be_floatle(dst+1, 2, &_right[0], 1, nframes);
-		}
-#else
-		if(_little_endian) {
-		bams_copy_s16le_floatbe(dst, 2, &_left[0], 1, nframes);
-		bams_copy_s16le_floatbe(dst+1, 2, &_right[0], 1, nframes);
-		} else {
-		bams_copy_s16be_floatbe(dst, 2, &_left[0], 1, nframes);
-		bams_copy_s16be_floatbe(dst+1, 2, &_right[0], 1, nframes);
+	while(pos < nframes) {
+		frames = nframes - pos;
+		if((err = snd_pcm_mmap_begin(_playback_handle, &areas, &offset, &frames)) < 0) {
+		return err;
 		}
-#endif
-	}   break;
-	case 8:
-	case 24:
-	case 32:
-	default:
-		assert(false);
+		// Interleaved: the right channel follows the left in
+		// the same area.
+		assert(areas[1].addr == areas[0].addr);
+		assert(areas[0].step == _channels * (areas[1].first - areas[0].first));
+		dst = (char*)areas[0].addr + (areas[0].first + offset * areas[0].step) / 8;
+
+		_convert(dst, &_left[pos], &_right[pos], frames, _dither_state);
+
+		committed = snd_pcm_mmap_commit(_playback_handle, offset, frames);
+		if(committed < 0)
+		return committed;
+		if(snd_pcm_uframes_t(committed) != frames)
+		return -EPIPE;
+		pos += frames;
+	}
+
+	// Normally the commit starts the device once the start
+	// threshold is reached.  After a prepare (start up, or an xrun)
+	// it may not have been, so start it here if it's still
+	// waiting.
+	if(snd_pcm_state(_playback_handle) == SND_PCM_STATE_PREPARED) {
+		if((err = snd_pcm_start(_playback_handle)) < 0)
+		return err;
 	}
+	return 0;
 	}
 
-	void AlsaAudioSystem::_convert_to_output_uint(uint32_t nframes)
+	/**
+	 * \brief Count an xrun (or suspend), and restart the device.
+	 * [RT SAFE]
+	 *
+	 * \return 0 on success, or a negative ALSA error code.
+	 */
+	int AlsaAudioSystem::_recover_xrun(int err)
 	{
-	switch(_bits) {
-	case 16: {
-		bams_sample_u16le_t *dst = (bams_sample_u16le_t*)_buf;
-#if __BYTE_ORDER == __LITTLE_ENDIAN
-		if(_little_endian) {
-		bams_copy_u16le_floatle(dst, 2, &_left[0], 1, nframes);
-		bams_copy_u16le_floatle(dst+1, 2, &_right[0], 1, nframes);
-		} else {
-		bams_copy_u16be_floatle(dst, 2, &_left[0], 1, nframes);
-		bams_copy_u16be_floatle(dst+1, 2, &_right[0], 1, nframes);
-		}
-#else
-		if(_little_endian) {
-		bams_copy_u16le_floatbe(dst, 2, &_left[0], 1, nframes);
-		bams_copy_u16le_floatbe(dst+1, 2, &_right[0], 1, nframes);
-		} else {
-		bams_copy_u16be_floatbe(dst, 2, &_left[0], 1, nframes);
-		bams_copy_u16be_floatbe(dst+1, 2, &_right[0], 1, nframes);
-		}
-#endif
-	}   break;
-	case 8:
-	case 24:
-	case 32:
-	default:
-		assert(false);
-	}
+	_xruns.fetch_add(1, std::memory_order_relaxed);
+	return snd_pcm_recover(_playback_handle, err, 1);
 	}
 
-	void AlsaAudioSystem::_convert_to_output_float(uint32_t nframes)
+	/**
+	 * \brief Print the number of new xruns, about once a second
+	 * while the driver is active, and once more when it stops.
+	 */
+	void AlsaAudioSystem::_report_xruns()
 	{
-	float *out, *l, *r;
-	uint32_t f, count;
-	assert(_bits == 32);
-	assert(_little_endian);
-	out = (float*)_buf;
-	l = &_left[0];
-	r = &_right[0];
-	count = nframes;
-	while(count--) {
-		(*out++) = (*l++);
-		(*out++) = (*r++);
-	}
-	/* Check for non-native byte ordering */
-#if __BYTE_ORDER == __LITTLE_ENDIAN
-	if(!_little_endian) {
-		bams_byte_reorder_in_place(_buf, 4, 1, 2*nframes);
-	}
-#else
-	if(_little_endian) {
-		bams_byte_reorder_in_place(_buf, 4, 1, 2*nframes);
+	unsigned long reported = _xruns.load(), n;
+	int tick = 0;
+	bool last = false;
+
+	while(!last) {
+		usleep(100000);
+		last = !_active;
+		if(++tick < 10 && !last)
+		continue;
+		tick = 0;
+		n = _xruns.load();
+		if(n != reported) {
+		cerr << "ALSA: " << (n - reported) << " xrun(s)" << endl;
+		reported = n;
+		}
 	}
-#endif
 	}
 
 } // namespace StretchPlayer
@@ -22,6 +22,9 @@
 #include <AudioSystem.hpp>
 #include <alsa/asoundlib.h>
 #include <sys/time.h>
+#include <atomic>
+#include <thread>
+#include "jack_memops.h"
 
 namespace StretchPlayer
 {
@@ -54,15 +57,21 @@ namespace StretchPlayer
 	virtual uint32_t segment_start_time_stamp();
 	virtual uint32_t current_segment_size();
 
+	/**
+	 * \brief Converts and interleaves a period into the device's
+	 * sample format.
+	 */
+	typedef void (*convert_t)(void *dst, const float *left, const float *right,
+				  uint32_t nframes, dither_state_t *dither);
+
 	private:
 	static void run(AlsaAudioSystem *that) {
 		that->_run();
 	}
 	void _run();
-	void _convert_to_output(uint32_t nframes);
-	void _convert_to_output_int(uint32_t nframes);
-	void _convert_to_output_uint(uint32_t nframes);
-	void _convert_to_output_float(uint32_t nframes);
+	int _write_mmap(uint32_t nframes);
+	int _recover_xrun(int err);
+	void _report_xruns();
 
 	void _stopwatch_init();
 	void _stopwatch_start_idle();
@@ -72,14 +81,15 @@ namespace StretchPlayer
 	private:
 	// Configuration variables:
 	unsigned _channels;
-	enum { INT, UINT, FLOAT } _type;
-	unsigned _bits;
-	bool _little_endian;
+	unsigned _bytes; // per sample, in the buffer
+	convert_t _convert; // chosen by init() for the device's format
+	dither_state_t _dither_state[2];
 	uint32_t _sample_rate;
 	uint32_t _period_nframes;
 
 	// ALSA handles
 	bool _active;
+	bool _mmap; // convert straight into the device's buffer
 	snd_pcm_t *_playback_handle;
 	float *_left_root, *_right_root;
 	float *_left, *_right;
@@ -96,6 +106,11 @@ namespace StretchPlayer
 	unsigned long _dsp_work_time[DSP_AVG_SIZE];
 	float _dsp_load;
 
+	// Xruns are counted by the audio thread, and reported by
+	// _xrun_reporter, since printing isn't realtime safe.
+	std::atomic<unsigned long> _xruns;
+	std::thread _xrun_reporter;
+
 	// Private object
 	AlsaAudioSystemPrivate *_d;
 
@@ -19,6 +19,7 @@
 
 #include "config.h"
 #include "Configuration.hpp"
+#include "NullAudioSystem.hpp"
 #include <stdexcept>
 
 #ifdef AUDIO_SUPPORT_JACK
@@ -45,6 +46,9 @@ namespace StretchPlayer
 		d = new AlsaAudioSystem;
 		break;
 #endif
+	case Configuration::NullDriver:
+		d = new NullAudioSystem;
+		break;
 	default:
 		throw std::runtime_error("Unsupported driver requested");
 	}
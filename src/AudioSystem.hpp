@@ -144,6 +144,24 @@ namespace StretchPlayer
 	 *
 	 */
 	virtual uint32_t current_segment_size() = 0;
+
+	/**
+	 * True if the process callback is called back to back instead
+	 * of in real time.  Then the callback may block, e.g. to wait
+	 * for the stretcher, without causing an xrun.
+	 */
+	virtual bool free_running() {
+		return false;
+	}
+
+	/**
+	 * Called from the process callback to say whether the
+	 * application is idle (i.e. only putting out silence because
+	 * nothing is playing).  A free-running driver uses this to
+	 * stop spinning.  [RT SAFE]
+	 */
+	virtual void set_idle(bool /*idle*/) {
+	}
 	};
 
 	AudioSystem* audio_system_factory(int driver);
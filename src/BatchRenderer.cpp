@@ -0,0 +1,181 @@
+/*
+ * Copyright(c) 2010 by Gabriel M. Beddingfield <gabriel@teuton.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY, without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "BatchRenderer.hpp"
+#include <thread>
+#include <set>
+#include <cstdio>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+namespace StretchPlayer
+{
+	BatchRenderer::BatchRenderer(unsigned threads) :
+		_threads(threads),
+		_next(0),
+		_failed(0)
+	{
+		if( _threads == 0 ) {
+			_threads = std::thread::hardware_concurrency();
+		}
+		if( _threads == 0 ) {
+			_threads = 1;
+		}
+	}
+
+	BatchRenderer::~BatchRenderer()
+	{
+	}
+
+	void BatchRenderer::add(const job_t& job)
+	{
+		job_t j = job;
+		// A deque never moves its elements when it grows.
+		_names.push_back(job.input);
+		j.input = _names.back().c_str();
+		_names.push_back(job.output);
+		j.output = _names.back().c_str();
+		_jobs.push_back(j);
+	}
+
+	bool BatchRenderer::read_list(const char *filename, bool mono, int shift,
+				  char *err_msg, size_t err_size)
+	{
+		std::vector<std::string> fields;
+		std::vector<job_t> jobs;
+		std::deque<std::string> names;
+		std::set<std::string> outputs;
+		char line[4096];
+		unsigned lineno = 0;
+		FILE *f;
+
+		for( size_t k=0 ; k<_jobs.size() ; ++k ) {
+			outputs.insert(_jobs[k].output);
+		}
+
+		f = fopen(filename, "r");
+		if( !f ) {
+			snprintf(err_msg, err_size, "Error opening job list '%s'", filename);
+			return false;
+		}
+		while( fgets(line, sizeof(line), f) ) {
+			++lineno;
+			line[strcspn(line, "\r\n")] = '\0';
+			if( line[0] == '\0' || line[0] == '#' ) {
+				continue;
+			}
+
+			fields.clear();
+			char *p = line, *tab;
+			while( (tab = strchr(p, '\t')) != 0 ) {
+				fields.push_back(std::string(p, tab - p));
+				p = tab + 1;
+			}
+			fields.push_back(p);
+
+			job_t job;
+			double stretch = 0;
+			long pitch = 0;
+			char *end;
+			bool ok = fields.size() == 4 && !fields[0].empty() && !fields[3].empty();
+			if( ok ) {
+				stretch = strtod(fields[1].c_str(), &end);
+				ok = end != fields[1].c_str() && *end == '\0'
+					&& stretch > 0 && std::isfinite(stretch);
+			}
+			if( ok ) {
+				pitch = strtol(fields[2].c_str(), &end, 10);
+				ok = end != fields[2].c_str() && *end == '\0' && pitch >= -12 && pitch <= 12;
+			}
+			job.stretch = stretch / 100.0;
+			job.pitch = pitch;
+			job.shift = shift;
+			job.mono = mono;
+			if( !ok || !(job.stretch > 0) ) {
+				snprintf(err_msg, err_size, "Error in job list '%s', line %u: "
+					 "expected input, stretch, pitch, and output separated by tabs",
+					 filename, lineno);
+				fclose(f);
+				return false;
+			}
+			// Two workers would write the same file at once.
+			if( !outputs.insert(fields[3]).second ) {
+				snprintf(err_msg, err_size, "Error in job list '%s', line %u: "
+					 "output '%s' is already written by another job",
+					 filename, lineno, fields[3].c_str());
+				fclose(f);
+				return false;
+			}
+			names.push_back(fields[0]);
+			names.push_back(fields[3]);
+			jobs.push_back(job);
+		}
+		fclose(f);
+
+		for( size_t k=0 ; k<jobs.size() ; ++k ) {
+			jobs[k].input = names[2*k].c_str();
+			jobs[k].output = names[2*k + 1].c_str();
+			add(jobs[k]);
+		}
+		return true;
+	}
+
+	size_t BatchRenderer::run()
+	{
+		std::vector<std::thread> workers;
+		unsigned n = _threads;
+
+		if( n > _jobs.size() ) {
+			n = _jobs.size();
+		}
+		_next = 0;
+		_failed = 0;
+		for( unsigned k=0 ; k<n ; ++k ) {
+			workers.push_back( std::thread(&BatchRenderer::_work, this) );
+		}
+		for( unsigned k=0 ; k<n ; ++k ) {
+			workers[k].join();
+		}
+		return _failed;
+	}
+
+	/**
+	 * One worker: render jobs until the list is used up.
+	 */
+	void BatchRenderer::_work()
+	{
+		OfflineRenderer renderer(false);
+		size_t k;
+		bool ok;
+
+		while( (k = _next.fetch_add(1)) < _jobs.size() ) {
+			char err[1024] = "";
+			ok = renderer.render(_jobs[k], err, sizeof(err));
+			if( !ok ) {
+				++_failed;
+			}
+			if( _done ) {
+				std::lock_guard<std::mutex> lk(_done_lock);
+				_done(k, _jobs[k], ok ? 0 : err);
+			}
+		}
+	}
+
+} // namespace StretchPlayer
@@ -0,0 +1,121 @@
+/*
+ * Copyright(c) 2010 by Gabriel M. Beddingfield <gabriel@teuton.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY, without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+#ifndef BATCHRENDERER_HPP
+#define BATCHRENDERER_HPP
+
+#include <stdint.h>
+#include <string>
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include "OfflineRenderer.hpp"
+
+namespace StretchPlayer
+{
+	/**
+	 * \brief Renders a list of jobs on a fixed pool of threads.
+	 *
+	 * Each worker has its own OfflineRenderer (and so its own
+	 * RubberBand instance), and takes the next job from the list
+	 * until there are none left.  Decoding overlaps with
+	 * stretching because every job reads through a DiskStreamer.
+	 *
+	 * A job's output only depends on the job, never on the number
+	 * of threads or which worker ran it: each one starts from a
+	 * reset stretcher, and RubberBand's own threading is off.
+	 */
+	class BatchRenderer
+	{
+	public:
+	typedef OfflineRenderer::job_t job_t;
+
+	/**
+	 * Called (from a worker thread, one at a time) when a job is
+	 * finished.
+	 *
+	 * \param index position of the job in the list
+	 * \param err_msg 0 if the job succeeded
+	 */
+	typedef std::function<void (size_t index, const job_t& job, const char *err_msg)> done_callback_t;
+
+	/**
+	 * \param threads number of workers.  0 for one per core.
+	 */
+	BatchRenderer(unsigned threads);
+	BatchRenderer(const BatchRenderer&) = delete;
+	~BatchRenderer();
+
+	/**
+	 * Add the jobs in a list file.  Each line is
+	 *
+	 *   input<TAB>stretch<TAB>pitch<TAB>output
+	 *
+	 * with stretch in percent (e.g. 87.5) and pitch in semitones.
+	 * Blank lines and lines starting with '#' are skipped.  No two
+	 * jobs (including those already added) may have the same
+	 * output.
+	 *
+	 * \param mono, shift applied to every job.
+	 * \return true on success.  On failure, err_msg (err_size
+	 * bytes) will have a description of the error, and no jobs
+	 * are added.
+	 */
+	bool read_list(const char *filename, bool mono, int shift, char *err_msg, size_t err_size);
+
+	/**
+	 * Copies the file names.
+	 */
+	void add(const job_t& job);
+
+	size_t size() const {
+		return _jobs.size();
+	}
+	unsigned threads() const {
+		return _threads;
+	}
+
+	void set_done_callback(const done_callback_t& cb) {
+		_done = cb;
+	}
+
+	/**
+	 * Run all of the jobs, and wait for them.
+	 *
+	 * \return the number of jobs that failed.
+	 */
+	size_t run();
+
+	private:
+	void _work();
+
+	private:
+	unsigned _threads;
+	std::deque<std::string> _names;  // storage for the jobs' file names
+	std::vector<job_t> _jobs;
+	std::atomic<size_t> _next;
+	std::atomic<size_t> _failed;
+	std::mutex _done_lock;
+	done_callback_t _done;
+	};
+
+} // namespace StretchPlayer
+
+#endif // BATCHRENDERER_HPP
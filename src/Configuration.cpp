@@ -38,6 +38,8 @@ using namespace std;
 #define DEFAULT_SHIFT "0"
 #define DEFAULT_STRETCH "100"
 #define DEFAULT_PITCH "0"
+#define DEFAULT_READ_AHEAD "4"
+#define DEFAULT_CACHE_SIZE "4096"
 
 namespace StretchPlayer
 {
@@ -77,21 +79,45 @@ namespace StretchPlayer
       defaultDeviceName,
 	  "device to use for ALSA" },
 
+	{ "n:",
+	  {"periods", 1, 0, 'n'},
+	  DEFAULT_PERIODS_PER_BUFFER,
+	  "periods per buffer for ALSA" },
+
+	{ "D",
+	  {"dither", 0, 0, 'D'},
+	  "off",
+	  "TPDF dither for 24 and 32 bit ALSA output" },
+#endif
+
+	{ "N",
+	  {"null", 0, 0, 'N'},
+#if defined( AUDIO_SUPPORT_JACK ) || defined( AUDIO_SUPPORT_ALSA )
+	  "off",
+#else
+	  "on",
+#endif
+	  "use no audio device (for headless hosts and benchmarks)" },
+
 	{ "r:",
 	  {"sample-rate", 1, 0, 'r'},
 	  DEFAULT_SAMPLE_RATE,
-	  "sample rate to use for ALSA" },
+	  "sample rate to use for ALSA or --null" },
 
 	{ "p:",
 	  {"period-size", 1, 0, 'p'},
 	  DEFAULT_PERIOD_SIZE,
-	  "period size to use for ALSA" },
+	  "period size to use for ALSA or --null" },
 
-	{ "n:",
-	  {"periods", 1, 0, 'n'},
-	  DEFAULT_PERIODS_PER_BUFFER,
-	  "periods per buffer for ALSA" },
-#endif
+	{ "w:",
+	  {"null-output", 1, 0, 'w'},
+	  "none",
+	  "with --null, write the output to this file (.wav, else raw floats)" },
+
+	{ "f",
+	  {"free-run", 0, 0, 'f'},
+	  "off",
+	  "with --null, process as fast as possible instead of in real time (the output is the same every run, and only has what was played)" },
 
 	{ "x",
 	  {"no-autoconnect", 0, 0, 'x'},
@@ -135,6 +161,60 @@ namespace StretchPlayer
 		"merge all sound channels into the one: make it mono."
 	},
 
+	{ "t",
+	  {"stream", 0, 0, 't'},
+	  "off",
+	  "stream the file from disk instead of loading it into memory"
+	},
+
+	{ "R:",
+	  {"read-ahead", 1, 0, 'R'},
+	  DEFAULT_READ_AHEAD,
+	  "how far to decode ahead when streaming (in seconds)"
+	},
+
+	{ "g",
+	  {"progressive", 0, 0, 'g'},
+	  "off",
+	  "start playing while the file is still loading"
+	},
+
+	{ "F:",
+	  {"storage", 1, 0, 'F'},
+	  "float",
+	  "sample format in memory: float, int16, or half (16 bit halves memory use)"
+	},
+
+	{ "c:",
+	  {"cache-dir", 1, 0, 'c'},
+	  "none",
+	  "keep decoded audio in this directory for fast re-opening"
+	},
+
+	{ "C:",
+	  {"cache-size", 1, 0, 'C'},
+	  DEFAULT_CACHE_SIZE,
+	  "size limit for the cache directory (in MB)"
+	},
+
+	{ "o:",
+	  {"render", 1, 0, 'o'},
+	  "none",
+	  "stretch the file into this one (WAV or FLAC) as fast as possible, then exit"
+	},
+
+	{ "b:",
+	  {"batch", 1, 0, 'b'},
+	  "none",
+	  "render each line (input, stretch %, pitch, output; tab separated) of this file, then exit"
+	},
+
+	{ "j:",
+	  {"jobs", 1, 0, 'j'},
+	  "one per core",
+	  "number of files to render at once with --batch"
+	},
+
 	{ 0,
 	  {0, 0, 0, 0},
 	  0,
@@ -420,7 +500,7 @@ namespace StretchPlayer
 #elif defined( AUDIO_SUPPORT_ALSA )
 	driver = AlsaDriver;
 #else
-#error "Must have support for at least ONE audio API"
+	driver = NullDriver;
 #endif
 	audio_device( defaultDeviceName );
 	sample_rate( atoi(DEFAULT_SAMPLE_RATE) );
@@ -430,10 +510,22 @@ namespace StretchPlayer
 	stretch( atoi(DEFAULT_STRETCH) );
 	pitch( atoi(DEFAULT_PITCH) );
 	startup_file( 0 );
+	read_ahead( atof(DEFAULT_READ_AHEAD) );
+	cache_dir( 0 );
+	cache_size( atoi(DEFAULT_CACHE_SIZE) );
 	autoconnect(true);
 	quiet(false);
 	help(false);
 	mono(false);
+	stream(false);
+	progressive(false);
+	storage(FloatStorage);
+	render_file( 0 );
+	batch_file( 0 );
+	jobs( 0 );
+	null_output( 0 );
+	free_run(false);
+	dither(false);
 
 	bool bad = false;
 	int i, c;
@@ -453,6 +545,15 @@ namespace StretchPlayer
 		case 'A':
 			driver(AlsaDriver);
 			break;
+		case 'N':
+			driver(NullDriver);
+			break;
+		case 'w':
+			null_output(optarg);
+			break;
+		case 'f':
+			free_run(true);
+			break;
 		case 'd':
 			audio_device(optarg);
 			break;
@@ -465,6 +566,9 @@ namespace StretchPlayer
 		case 'n':
 			periods_per_buffer( atoi(optarg) );
 			break;
+		case 'D':
+			dither(true);
+			break;
 		case 's':
 			i = atoi(optarg);
 			shift( i );
@@ -489,6 +593,41 @@ namespace StretchPlayer
 		case 'm':
 			mono(true);
 			break;
+		case 't':
+			stream(true);
+			break;
+		case 'R':
+			read_ahead( atof(optarg) );
+			break;
+		case 'g':
+			progressive(true);
+			break;
+		case 'F':
+			if( !strcmp(optarg, "float") ) {
+				storage(FloatStorage);
+			} else if( !strcmp(optarg, "int16") ) {
+				storage(Int16Storage);
+			} else if( !strcmp(optarg, "half") ) {
+				storage(HalfStorage);
+			} else {
+				bad = true;
+			}
+			break;
+		case 'c':
+			cache_dir(optarg);
+			break;
+		case 'C':
+			cache_size( atoi(optarg) );
+			break;
+		case 'o':
+			render_file(optarg);
+			break;
+		case 'b':
+			batch_file(optarg);
+			break;
+		case 'j':
+			jobs( atoi(optarg) );
+			break;
 		default:
 			bad = true;
 		}
@@ -507,6 +646,15 @@ namespace StretchPlayer
 		if( period_size() == 0 ) bad = true;
 		if( periods_per_buffer() == 0 ) bad = true;
 	}
+	if( driver() == NullDriver ) {
+		if( sample_rate() == 0 ) bad = true;
+		if( period_size() == 0 ) bad = true;
+	}
+	if( stream() && read_ahead() <= 0.0f ) bad = true;
+	if( cache_dir() && cache_size() == 0 ) bad = true;
+	if( render_file() && !startup_file() ) bad = true;
+	if( render_file() && (stretch() <= 0) ) bad = true;
+	if( render_file() && batch_file() ) bad = true;
 
 	if( !bad ) ok.set(this, true);
 	}
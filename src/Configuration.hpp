@@ -74,7 +74,8 @@ private:
 class Configuration
 {
 public:
-	typedef enum { JackDriver = 1, AlsaDriver = 2 } driver_t;
+	typedef enum { JackDriver = 1, AlsaDriver = 2, NullDriver = 3 } driver_t;
+	typedef enum { FloatStorage = 0, Int16Storage = 1, HalfStorage = 2 } storage_t;
 
 	Configuration(int argc, char* argv[]);
 	~Configuration();
@@ -97,6 +98,18 @@ public:
 	Property<int>      shift; // positive - right ahead (left has actual timing), negative - left ahead (right has actual timing). In seconds.
 	Property<int>      stretch; // in percents
 	Property<int>      pitch; // from -12 to 12, frequency shift
+	Property<bool>     stream; // decode from disk while playing instead of loading into memory
+	Property<float>    read_ahead; // decode window when streaming. In seconds.
+	Property<const char *>  cache_dir; // decoded audio cache. 0 for none.
+	Property<unsigned> cache_size; // cache budget, in MB
+	Property<bool>     progressive; // start playing while the file is still loading
+	Property<storage_t> storage; // sample format for songs in memory
+	Property<const char *>  render_file; // stretch startup_file into this file and exit. 0 for none.
+	Property<const char *>  batch_file; // list of render jobs to run, then exit. 0 for none.
+	Property<unsigned> jobs; // threads for batch_file. 0 for one per core.
+	Property<const char *>  null_output; // where NullDriver writes its output. 0 for nowhere.
+	Property<bool>     free_run; // NullDriver runs as fast as possible instead of in real time
+	Property<bool>     dither; // TPDF dither for 24 and 32 bit ALSA output
 
 private:
 	void init(int argc, char* argv[]);
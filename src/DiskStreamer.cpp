@@ -0,0 +1,348 @@
+/*
+ * Copyright(c) 2010 by Gabriel M. Beddingfield <gabriel@teuton.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY, without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "DiskStreamer.hpp"
+#include "Mpg123.hpp"
+#include "bams_deinterleave.h"
+#include <sndfile.h>
+#include <mpg123.h>
+#include <cassert>
+#include <cstring>
+#include <cmath>
+#include <cstdio>
+
+namespace StretchPlayer
+{
+	/* Frames decoded per iteration of the reader thread */
+	static const uint32_t DECODE_BLOCK = 4096;
+
+	DiskStreamer::DiskStreamer() :
+		_running(false),
+		_sf(0),
+		_mh(0),
+		_frames(0),
+		_max_shift(0),
+		_sample_rate(48000.0),
+		_channels(0),
+		_encoding(0),
+		_mono(false),
+		_write_pos(0),
+		_read_pos(0),
+		_seek_pos(0),
+		_seek_gen(0),
+		_ack_gen(0)
+	{
+	}
+
+	DiskStreamer::~DiskStreamer()
+	{
+		_running = false;
+		nudge();
+		if(_thread.joinable())
+			_thread.join();
+		_close();
+	}
+
+	bool DiskStreamer::open(const char *filename, float read_ahead, float max_shift,
+				bool mono, char *err_msg, size_t err_size)
+	{
+		SF_INFO sf_info;
+		unsigned long window;
+		memset(&sf_info, 0, sizeof(sf_info));
+
+		assert( !_running );
+
+		_sf = sf_open(filename, SFM_READ, &sf_info);
+		if(_sf) {
+			_frames = sf_info.frames;
+			_sample_rate = sf_info.samplerate;
+			_channels = sf_info.channels;
+		} else {
+			int err;
+			long rate;
+			int channels, encoding;
+			off_t length;
+
+			if ((err = Mpg123::init()) == MPG123_OK &&
+				(_mh = mpg123_new(0, &err)) != 0) {
+				Mpg123::request_float(_mh);
+			}
+			if (_mh == 0 ||
+				mpg123_open(_mh, filename) != MPG123_OK ||
+				mpg123_getformat(_mh, &rate, &channels, &encoding) != MPG123_OK) {
+				snprintf(err_msg, err_size, "Error opening file '%s': %s", filename,
+					 (_mh == 0) ? mpg123_plain_strerror(err) : mpg123_strerror(_mh));
+				_close();
+				return false;
+			}
+			/* lock the output format */
+			Mpg123::lock_format(_mh, rate, channels, encoding);
+
+			/* Build the seek index so that locate() is sample accurate */
+			mpg123_scan(_mh);
+			length = mpg123_length(_mh);
+			if (length == MPG123_ERR || length == 0) {
+				snprintf(err_msg, err_size, "Error: file is empty or length unknown.");
+				_close();
+				return false;
+			}
+			_frames = length;
+			_sample_rate = rate;
+			_channels = channels;
+			_encoding = encoding;
+		}
+
+		if(_frames == 0) {
+			snprintf(err_msg, err_size, "Error opening file '%s': File is empty", filename);
+			_close();
+			return false;
+		}
+
+		window = read_ahead * _sample_rate;
+		if(window < 2 * DECODE_BLOCK)
+			window = 2 * DECODE_BLOCK;
+		// The leading channel is read max_shift past the lagging
+		// one, so it needs that much more room.
+		_max_shift = fabs(max_shift) * _sample_rate;
+		window += _max_shift;
+		_rings[0].reset( new ringbuffer_t(window) );
+		_rings[1].reset( new ringbuffer_t(window) );
+		_decode_buf.resize(DECODE_BLOCK * _channels);
+		if(_mh) {
+			// Raw decoder output, aligned for any encoding
+			_decode_raw.resize((DECODE_BLOCK * Mpg123::frame_bytes(_encoding, _channels)
+					    + sizeof(double) - 1) / sizeof(double));
+		}
+
+		_mono = mono && (_channels > 1);
+		_write_pos = 0;
+		_read_pos = 0;
+		_running = true;
+		_thread = std::thread(&DiskStreamer::_run, this);
+		return true;
+	}
+
+	void DiskStreamer::_close()
+	{
+		if(_sf) {
+			sf_close(_sf);
+			_sf = 0;
+		}
+		if(_mh) {
+			mpg123_close(_mh);
+			mpg123_delete(_mh);
+			_mh = 0;
+		}
+	}
+
+	void DiskStreamer::nudge()
+	{
+		_wait_cond.notify_one();
+	}
+
+	uint32_t DiskStreamer::read(unsigned long pos, long shift, float *&left, float *&right, uint32_t count)
+	{
+		unsigned long avail, ahead, lead_avail;
+		uint32_t lead_count;
+		ringbuffer_t *base, *lead;
+		float *base_buf, *lead_buf;
+
+		if(pos != _read_pos) {
+			_read_pos = pos;
+			_seek_pos.store(pos, std::memory_order_relaxed);
+			_seek_gen.fetch_add(1, std::memory_order_release);
+			nudge();
+			return 0;
+		}
+		if(_ack_gen.load(std::memory_order_acquire) != _seek_gen.load(std::memory_order_relaxed)) {
+			return 0;  // Still seeking
+		}
+		if(pos >= _frames) {
+			return 0;
+		}
+
+		avail = _rings[1]->read_space(); // Right is always written last
+		if(count > _frames - pos)
+			count = _frames - pos;
+
+		if(shift >= 0) {
+			ahead = shift;
+			base = _rings[0].get();  base_buf = left;
+			lead = _rings[1].get();  lead_buf = right;
+		} else {
+			ahead = -shift;
+			base = _rings[1].get();  base_buf = right;
+			lead = _rings[0].get();  lead_buf = left;
+		}
+
+		/* The leading channel needs [pos+ahead, pos+ahead+count)
+		 * to be in the window.  If that's past the end of the song,
+		 * it's silence.  If the shift is past max_shift(), it
+		 * doesn't fit in the window and is also silence.
+		 */
+		if(ahead && (ahead < _frames - pos) && (ahead + count < _rings[0]->bufsize())) {
+			unsigned long need = pos + ahead + count;
+			if(need > _frames)
+				need = _frames;
+			if(need - pos > avail)
+				count = (avail > ahead) ? (avail - ahead) : 0;
+		}
+		if(count > avail)
+			count = avail;
+		if(count == 0)
+			return 0;
+
+		lead_avail = (ahead < avail) ? (avail - ahead) : 0;
+		lead_count = (count < lead_avail) ? count : lead_avail;
+
+		base->read(base_buf, count);
+		if(ahead) {
+			_peek(lead, ahead, lead_buf, lead_count);
+			memset(lead_buf + lead_count, 0, (count - lead_count) * sizeof(float));
+			lead->increment_read_idx(count);
+		} else {
+			lead->read(lead_buf, count);
+		}
+
+		_read_pos += count;
+		nudge();
+		return count;
+	}
+
+	/**
+	 * Copy count items starting offset items after the read
+	 * pointer, without moving the read pointer.
+	 */
+	void DiskStreamer::_peek(ringbuffer_t *rb, unsigned long offset, float *dst, uint32_t count)
+	{
+		unsigned idx, n;
+
+		if(count == 0)
+			return;
+		idx = (rb->get_read_idx() + offset) & (rb->bufsize() - 1);
+		n = rb->bufsize() - idx;
+		if(n > count)
+			n = count;
+		memcpy(dst, rb->buffer() + idx, n * sizeof(float));
+		if(count > n)
+			memcpy(dst + n, rb->buffer(), (count - n) * sizeof(float));
+	}
+
+	bool DiskStreamer::_seek(unsigned long pos)
+	{
+		if(pos > _frames)
+			pos = _frames;
+		_write_pos = pos;
+		if(_sf)
+			return sf_seek(_sf, pos, SEEK_SET) >= 0;
+		if(_mh)
+			return mpg123_seek(_mh, pos, SEEK_SET) >= 0;
+		return false;
+	}
+
+	/**
+	 * Decode up to count frames and push them into the rings.
+	 *
+	 * \return number of frames written.
+	 */
+	uint32_t DiskStreamer::_decode(uint32_t count)
+	{
+		float left[DECODE_BLOCK], right[DECODE_BLOCK];
+		float *planar[2] = { left, right };
+		int nplanar = (_channels > 1) ? 2 : 1;
+		uint32_t k, got = 0;
+
+		if(count > DECODE_BLOCK)
+			count = DECODE_BLOCK;
+		if(count > _frames - _write_pos)
+			count = _frames - _write_pos;
+
+		if(_sf) {
+			sf_count_t read = sf_readf_float(_sf, &_decode_buf[0], count);
+			if(read > 0)
+				got = read;
+			bams_deinterleave_float(planar, nplanar, &_decode_buf[0], _channels, got);
+		} else if(_mh) {
+			size_t frame_bytes = Mpg123::frame_bytes(_encoding, _channels);
+			size_t bytes = 0;
+			int err = mpg123_read(_mh, (unsigned char*)&_decode_raw[0],
+					      count * frame_bytes, &bytes);
+			if(err == MPG123_OK || err == MPG123_DONE)
+				got = bytes / frame_bytes;
+			Mpg123::deinterleave(planar, nplanar, &_decode_raw[0], _encoding,
+					     _channels, got, _decode_buf);
+		}
+
+		if(nplanar == 1) {
+			memcpy(right, left, got * sizeof(float));
+		}
+
+		if(_mono) {
+			for(k=0 ; k<got ; ++k) {
+				left[k] = right[k] = (left[k] + right[k]) / 2.f;
+			}
+		}
+
+		if(got == 0) {
+			/* The decoder ran out before the reported length (or
+			 * failed).  Pad with silence so that the audio thread
+			 * doesn't wait forever at the end of the song.
+			 */
+			got = count;
+			memset(left, 0, got * sizeof(float));
+			memset(right, 0, got * sizeof(float));
+		}
+
+		_rings[0]->write(left, got);
+		_rings[1]->write(right, got);
+		_write_pos += got;
+		return got;
+	}
+
+	void DiskStreamer::_run()
+	{
+		unsigned gen;
+		uint32_t space;
+
+		while(_running) {
+			gen = _seek_gen.load(std::memory_order_acquire);
+			if(gen != _ack_gen.load(std::memory_order_relaxed)) {
+				/* The audio thread stops reading the rings as
+				 * soon as it requests a seek, so it's safe to
+				 * reset them here.
+				 */
+				_rings[0]->reset();
+				_rings[1]->reset();
+				_seek( _seek_pos.load(std::memory_order_relaxed) );
+				_ack_gen.store(gen, std::memory_order_release);
+				continue;
+			}
+
+			space = _rings[0]->write_space();
+			if( (_write_pos < _frames) && (space >= DECODE_BLOCK) ) {
+				_decode(DECODE_BLOCK);
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lk(_wait_mutex);
+			_wait_cond.wait_for(lk, std::chrono::milliseconds(100));
+		}
+	}
+
+} // namespace StretchPlayer
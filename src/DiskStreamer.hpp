@@ -0,0 +1,150 @@
+/*
+ * Copyright(c) 2010 by Gabriel M. Beddingfield <gabriel@teuton.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY, without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+#ifndef DISKSTREAMER_HPP
+#define DISKSTREAMER_HPP
+
+#include <stdint.h>
+#include <cstddef>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <vector>
+#include "RingBuffer.hpp"
+#include "Song.hpp"
+
+struct SNDFILE_tag;
+struct mpg123_handle_struct;
+
+namespace StretchPlayer
+{
+	/**
+	 * \brief Decodes an audio file from disk in its own thread.
+	 *
+	 * Instead of decoding the whole song into memory, the
+	 * streamer keeps a bounded window of decoded audio ahead of
+	 * the play position.  The audio thread consumes it with
+	 * read(), which is realtime safe.  Whenever read() is asked
+	 * for a position that doesn't follow the previous one (locate,
+	 * A/B loop), the streamer seeks and refills the window.
+	 */
+	class DiskStreamer : public Song
+	{
+	public:
+	typedef Tritium::RingBuffer<float> ringbuffer_t;
+
+	DiskStreamer();
+	DiskStreamer(const DiskStreamer&) = delete;
+	virtual ~DiskStreamer();
+
+	/**
+	 * Open the file and start the reader thread.
+	 *
+	 * \param read_ahead size of the decode window, in seconds.
+	 *
+	 * \param max_shift largest channel shift (in seconds, either
+	 * sign) that read() has to serve.  The window is grown by
+	 * this much so the leading channel stays inside it.
+	 *
+	 * \param mono if true, mix all channels down to mono.
+	 *
+	 * \return true on success.  On failure, err_msg (err_size
+	 * bytes) will have a description of the error.
+	 */
+	bool open(const char *filename, float read_ahead, float max_shift,
+		  bool mono, char *err_msg, size_t err_size);
+
+	/**
+	 * Largest |shift| (in frames) that read() can serve.
+	 */
+	unsigned long max_shift() const {
+		return _max_shift;
+	}
+
+	/* Implementing all of Song's interface:
+	 */
+	virtual unsigned long frames() const {
+		return _frames;
+	}
+	virtual float sample_rate() const {
+		return _sample_rate;
+	}
+	virtual int channels() const {
+		return _channels;
+	}
+
+	/**
+	 * Always copies into the scratch buffers.  Data past the end
+	 * of the song is silence.  Returns less than count if the
+	 * reader thread hasn't caught up (e.g. right after a seek).
+	 */
+	virtual uint32_t read(unsigned long pos, long shift, float *&left, float *&right, uint32_t count);
+
+	/**
+	 * There is one decode window, and any jump refills it.
+	 */
+	virtual bool random_access() const {
+		return false;
+	}
+
+	void nudge(); // Wake up thread in case it's sleeping.
+
+	private:
+	void _run();
+	void _close();
+	bool _seek(unsigned long pos);
+	uint32_t _decode(uint32_t count);
+	void _peek(ringbuffer_t *rb, unsigned long offset, float *dst, uint32_t count);
+
+	private:
+	std::thread _thread;
+	std::atomic<bool> _running;
+	SNDFILE_tag *_sf;
+	mpg123_handle_struct *_mh;
+	unsigned long _frames;
+	unsigned long _max_shift;
+	float _sample_rate;
+	int _channels;
+	int _encoding;                     // mpg123 output encoding
+	bool _mono;
+
+	std::unique_ptr< ringbuffer_t > _rings[2];
+	std::vector<float> _decode_buf;   // interleaved, reader thread only
+	std::vector<double> _decode_raw;  // mpg123 output, reader thread only
+	unsigned long _write_pos;          // reader thread only
+	unsigned long _read_pos;           // audio thread only
+
+	/* Seek requests.  The audio thread sets _seek_pos and bumps
+	 * _seek_gen.  Once the reader thread has emptied the rings
+	 * and refilled from the new position, it copies _seek_gen to
+	 * _ack_gen.  The audio thread doesn't touch the rings while
+	 * the two differ.
+	 */
+	std::atomic<unsigned long> _seek_pos;
+	std::atomic<unsigned> _seek_gen;
+	std::atomic<unsigned> _ack_gen;
+
+	mutable std::condition_variable _wait_cond;
+	mutable std::mutex _wait_mutex;
+	};
+
+} // namespace StretchPlayer
+
+#endif // DISKSTREAMER_HPP
@@ -20,6 +20,11 @@
 #include "Engine.hpp"
 #include "AudioSystem.hpp"
 #include "Configuration.hpp"
+#include "MemorySong.hpp"
+#include "DiskStreamer.hpp"
+#include "PcmCache.hpp"
+#include "Mpg123.hpp"
+#include "bams_deinterleave.h"
 #include <sndfile.h>
 #include <mpg123.h>
 #include <stdexcept>
@@ -27,7 +32,9 @@
 #include <cstring>
 #include <cmath>
 #include <cstdlib>
+#include <climits>
 #include <algorithm>
+#include <unistd.h>
 
 #include "config.h"
 
@@ -35,20 +42,74 @@ using RubberBand::RubberBandStretcher;
 
 namespace StretchPlayer
 {
+	/* Largest block fetched from the Song at once */
+	static const uint32_t FEED_SCRATCH_SIZE = 4096;
+
+	/* Length of the crossfade in and out of bypass */
+	static const uint32_t BYPASS_XFADE = 512;
+
+	/* Length of the crossfade when seeking */
+	static const uint32_t SEEK_XFADE = 256;
+
+	/* Longest A/B loop output that is cached */
+	static const uint32_t LOOP_CACHE_SECONDS = 30;
+
+	/* Frames per read from the decoder libraries */
+	static const uint32_t DECODE_BLOCK = 4096;
+
+	/* Frames per read from libmpg123.  Each call has a fixed
+	 * overhead, so these are larger.
+	 */
+	static const uint32_t MPG123_BLOCK = 16384;
+
 	Engine::Engine(Configuration *config)
 	: _config(config),
 	  _playing(false),
 	  _hit_end(false),
 	  _state_changed(false),
+	  _song(0),
+	  _next_song(0),
+	  _old_song(0),
+	  _song_length(0),
+	  _loading(0),
+	  _underruns(0),
+	  _underruns_reported(0),
+	  _starved(false),
 	  _position(0),
 	  _loop_a(0),
 	  _loop_b(0),
+	  _loop_ab_pressed(0),
 	  _sample_rate(48000.0),
 	  _stretch(1.0),
 	  _shift(0),
+	  _max_shift(INT_MAX),
 	  _pitch(0),
 	  _gain(1.0),
-	  _output_position(0)
+	  _stretcher(&_stretchers[0]),
+	  _standby(&_stretchers[1]),
+	  _output_position(0),
+	  _bypass(BYPASS_OFF),
+	  _single_reader(false),
+	  _bypass_pos(0),
+	  _bypass_target(0),
+	  _discard(0),
+	  _xfade(0),
+	  _seek(SEEK_IDLE),
+	  _seek_requested(false),
+	  _seek_target(0),
+	  _seek_pos(0),
+	  _seek_old_pos(0),
+	  _seek_discard(0),
+	  _seek_xfade(0),
+	  _loop_cache(LOOP_CACHE_IDLE),
+	  _loop_cache_allocated(false),
+	  _loop_cache_capacity(0),
+	  _loop_cache_period(0),
+	  _loop_cache_fill(0),
+	  _loop_cache_idx(0),
+	  _loop_cache_fed(0),
+	  _loop_cache_in0(0),
+	  _loop_cache_ratio(1.0)
 	{
 		char err[1024] = "";
 
@@ -69,13 +130,34 @@ namespace StretchPlayer
 		if (err[0] != '\0')
 			throw std::runtime_error(err);
 
+		_feed_left.resize(FEED_SCRATCH_SIZE);
+		_feed_right.resize(FEED_SCRATCH_SIZE);
+		memset(&_loop_cache_key, 0, sizeof(_loop_cache_key));
+
+		// Raised cosine, so the two paths always sum to unity gain.
+		_xfade_curve.resize(BYPASS_XFADE);
+		for( uint32_t k=0 ; k<BYPASS_XFADE ; ++k ) {
+			_xfade_curve[k] = 0.5f - 0.5f * ::cos(M_PI * k / BYPASS_XFADE);
+		}
+		// Quarter sine.  Fading in uses [k], fading out [SEEK_XFADE-k].
+		_seek_curve.resize(SEEK_XFADE + 1);
+		for( uint32_t k=0 ; k<=SEEK_XFADE ; ++k ) {
+			_seek_curve[k] = ::sin(0.5 * M_PI * k / SEEK_XFADE);
+		}
+
+		if(_config && _config->cache_dir()) {
+			_cache.reset( new PcmCache(_config->cache_dir(),
+						   uint64_t(_config->cache_size()) << 20) );
+		}
 
 		uint32_t sample_rate = _audio_system->sample_rate();
 
 		//_stretcher = std::move( std::unique_ptr<RubberBandServer>(new RubberBandServer(sample_rate)) );
-		_stretcher.setSampleRate(sample_rate);
-		_stretcher.set_segment_size( _audio_system->current_segment_size() );
-		_stretcher.start();
+		for( int k=0 ; k<2 ; ++k ) {
+			_stretchers[k].setSampleRate(sample_rate);
+			_stretchers[k].set_segment_size( _audio_system->current_segment_size() );
+			_stretchers[k].start();
+		}
 
 		if( _audio_system->activate(err) )
 			throw std::runtime_error(err);
@@ -83,10 +165,14 @@ namespace StretchPlayer
 
 	Engine::~Engine()
 	{
+		_stop_decoder();
+
 		std::lock_guard<std::mutex> lk(_audio_lock);
 
-		_stretcher.go_idle();
-		_stretcher.shutdown();
+		for( int k=0 ; k<2 ; ++k ) {
+			_stretchers[k].go_idle();
+			_stretchers[k].shutdown();
+		}
 
 		_audio_system->deactivate();
 		_audio_system->cleanup();
@@ -99,8 +185,16 @@ namespace StretchPlayer
 		for( it=_message_callbacks.begin() ; it!=_message_callbacks.end() ; ++it ) {
 			(*it)->_parent = 0;
 		}
+		for( it=_underrun_callbacks.begin() ; it!=_underrun_callbacks.end() ; ++it ) {
+			(*it)->_parent = 0;
+		}
 
-		_stretcher.wait();
+		_stretchers[0].wait();
+		_stretchers[1].wait();
+
+		delete _song;
+		delete _next_song.exchange(0);
+		delete _old_song.exchange(0);
 	}
 
 	void Engine::_zero_buffers(uint32_t nframes)
@@ -121,13 +215,15 @@ namespace StretchPlayer
 
 	int Engine::segment_size_callback(uint32_t nframes)
 	{
-		_stretcher.set_segment_size(nframes);
+		_stretchers[0].set_segment_size(nframes);
+		_stretchers[1].set_segment_size(nframes);
 		return 0;
 	}
 
 	int Engine::process_callback(uint32_t nframes)
 	{
 		bool locked = false;
+		bool idle = false;
 
 		if( _loop_ab_pressed > 0 ) {
 			_handle_loop_ab();
@@ -137,22 +233,43 @@ namespace StretchPlayer
 			locked = _audio_lock.try_lock();
 			if(_state_changed) {
 			_state_changed = false;
-			_stretcher.reset();
+			_stretcher->reset();
 			float left[64], right[64];
-			while( _stretcher.available_read() > 0 )
-				_stretcher.read_audio(left, right, 64);
-			assert( 0 == _stretcher.available_read() );
+			while( _stretcher->available_read() > 0 )
+				_stretcher->read_audio(left, right, 64);
+			assert( 0 == _stretcher->available_read() );
+			if( _seek_requested ) {
+				_output_position = _seek_target;
+				_seek_requested = false;
+			}
 			_position = _output_position;
+			if( _seek != SEEK_IDLE ) {
+				_standby->reset();
+				_seek = SEEK_IDLE;
+			}
+			_loop_cache = LOOP_CACHE_IDLE;
+			_loop_cache_fed = 0;
+			// The stretcher is empty, so this is a fade in
+			// from silence.  _update_bypass() backs out if
+			// the settings aren't unity.  A single reader
+			// can't fade, so it starts on the direct path.
+			_bypass = _single_reader ? BYPASS_ON : BYPASS_ENTERING;
+			_bypass_pos = _position;
+			_xfade = 0;
 			}
 			if(locked) {
+				if(_next_song.load() && !_old_song.load()) {
+					_swap_song();
+				}
 				if(_playing) {
-					if(_left.size()) {
+					if(_song) {
 						_process_playing(nframes);
 					} else {
 						_playing = false;
 					}
 				} else {
 					_zero_buffers(nframes);
+					idle = true;
 				}
 			} else {
 				_zero_buffers(nframes);
@@ -162,11 +279,68 @@ namespace StretchPlayer
 
 		if(locked) _audio_lock.unlock();
 
+		_audio_system->set_idle(idle);
 		return 0;
 	}
 
+	/**
+	 * Take the song posted by load_song(). [RT SAFE]
+	 *
+	 * The previous song is posted in _old_song for load_song() to
+	 * delete, since freeing memory is not realtime safe.
+	 */
+	void Engine::_swap_song()
+	{
+		// MUTEX MUST ALREADY BE LOCKED
+		Song *old = _song;
+		Song *next = _next_song.exchange(0);
+
+		if( !next ) {
+			return; // load_song() gave up waiting and took it back
+		}
+		assert( _old_song.load() == 0 );
+		_song = next;
+		_single_reader = !_song->random_access();
+		_song_length = _song->frames();
+		_sample_rate = _song->sample_rate();
+		_playing = false;
+		_hit_end = false;
+		_starved = false;
+		_position = 0;
+		_output_position = 0;
+		_loop_a = 0;
+		_loop_b = 0;
+		_bypass = BYPASS_OFF;
+		_bypass_pos = 0;
+		_seek = SEEK_IDLE;
+		_seek_requested = false;
+		_loop_cache = LOOP_CACHE_IDLE;
+		_loop_cache_fed = 0;
+		_stretcher->reset();
+		_standby->reset();
+		_old_song.store(old);
+	}
+
 	static void apply_gain_to_buffer(float *buf, uint32_t frames, float gain);
 
+	static void apply_gain(float *buf_L, float *buf_R, uint32_t nframes, float gain)
+	{
+		if(gain == 1.0f) {
+			return;
+		}
+		// Apply gain... unroll loop manually so GCC will use SSE
+		if(nframes & 0xf) {  // nframes < 16
+			unsigned f = nframes;
+			while(f--) {
+			(*buf_L++) *= gain;
+			(*buf_R++) *= gain;
+			}
+		} else {
+			apply_gain_to_buffer(buf_L, nframes, gain);
+			apply_gain_to_buffer(buf_R, nframes, gain);
+		}
+	}
+
 	void Engine::_process_playing(uint32_t nframes)
 	{
 		// MUTEX MUST ALREADY BE LOCKED
@@ -178,21 +352,171 @@ namespace StretchPlayer
 		uint32_t srate = _audio_system->sample_rate();
 		float time_ratio = srate / _sample_rate / _stretch;
 
-		_stretcher.time_ratio( time_ratio );
-		_stretcher.pitch_scale( ::pow(2.0, double(_pitch)/12.0) * _sample_rate / srate );
+		float pitch_scale = ::pow(2.0, double(_pitch)/12.0) * _sample_rate / srate;
+
+		_stretcher->time_ratio( time_ratio );
+		_stretcher->pitch_scale( pitch_scale );
+		_standby->time_ratio( time_ratio );
+		_standby->pitch_scale( pitch_scale );
+
+		if( _seek_requested ) {
+			_seek_requested = false;
+			_start_seek();
+		}
+
+		// Playing the A/B loop out of the cache
+		if( _loop_cache == LOOP_CACHE_PLAYING && _loop_cache_key_changed() ) {
+			_loop_cache_leave();
+		}
+		if( _loop_cache == LOOP_CACHE_PLAYING || _loop_cache == LOOP_CACHE_LEAVING ) {
+			_loop_cache_play(buf_L, buf_R, nframes);
+			if( _loop_cache == LOOP_CACHE_LEAVING ) {
+				assert( !_single_reader );
+				_feed(_standby, _seek_pos);
+				_pull_standby(buf_L, buf_R, nframes);
+				_standby->nudge();
+				if( _seek == SEEK_IDLE ) {
+					// _standby has taken over
+					_loop_cache = LOOP_CACHE_IDLE;
+					_loop_cache_fed = 0;
+				}
+			}
+			apply_gain(buf_L, buf_R, nframes, _gain);
+			return;
+		}
+
+		_update_bypass( (srate == _sample_rate) && (_stretch == 1.0f) && (_pitch == 0) );
+
+		if( _bypass == BYPASS_ON ) {
+			assert( !_single_reader || _seek == SEEK_IDLE );
+			if( _seek == SEEK_DIRECT ) {
+				_seek_direct(buf_L, buf_R, nframes);
+			} else {
+				_bypass_mix(buf_L, buf_R, nframes, 0);
+			}
+			_output_position = _bypass_pos;
+			apply_gain(buf_L, buf_R, nframes, _gain);
+			if( _bypass_pos >= _song_length ) {
+				_playing = false;
+				_position = 0;
+				_bypass_pos = 0;
+			}
+			return;
+		}
+
+		assert( _stretcher->is_running() );
+		assert( !_single_reader || (_bypass == BYPASS_OFF && _seek == SEEK_IDLE) );
+
+		uint32_t fed = _feed(_stretcher, _position);
+		if( _seek == SEEK_PRIMING || _seek == SEEK_FADING ) {
+			_feed(_standby, _seek_pos);
+		}
+		if( _audio_system->free_running() ) {
+			fed += _wait_for_stretcher(nframes);
+		}
+
+		// Pull generated data off the stretcher
+		uint32_t read_space;
+		bool pulled = false;
+		read_space = _stretcher->available_read();
+
+		if( _bypass == BYPASS_LEAVING ) {
+			if( _pull_leaving(buf_L, buf_R, nframes) ) {
+				_bypass_mix(buf_L, buf_R, nframes, -1);
+				_xfade += nframes;
+				if( _xfade >= BYPASS_XFADE ) {
+					_bypass = BYPASS_OFF;
+				}
+			} else {
+				_bypass_mix(buf_L, buf_R, nframes, 0);
+			}
+		} else {
+			if( read_space >= nframes ) {
+				_stretcher->read_audio(buf_L, buf_R, nframes);
+				pulled = true;
+			} else if ( (read_space > 0) && _hit_end ) {
+				_zero_buffers(nframes);
+				_stretcher->read_audio(buf_L, buf_R, read_space);
+			} else {
+				_zero_buffers(nframes);
+			}
+			if( _seek != SEEK_IDLE ) {
+				_pull_standby(buf_L, buf_R, nframes);
+			}
+			if( _bypass == BYPASS_ENTERING ) {
+				_bypass_mix(buf_L, buf_R, nframes, 1);
+				_xfade += nframes;
+				if( _xfade >= BYPASS_XFADE ) {
+					_bypass = BYPASS_ON;
+					_stretcher->reset();
+				}
+			}
+		}
+
+		_loop_cache_record(buf_L, buf_R, nframes, pulled, fed);
+
+		// Update our estimation of the output position.
+		if( _bypass != BYPASS_OFF ) {
+			_output_position = _bypass_pos;
+		} else {
+			unsigned n_feed_buf = _stretcher->latency();
+			if(_position > n_feed_buf) {
+				_output_position = _position - n_feed_buf;
+			} else {
+				_output_position = 0;
+			}
+			assert( (_output_position > _position) ? (_output_position - _position) <= n_feed_buf : true );
+			assert( (_output_position < _position) ? (_position - _output_position) <= n_feed_buf : true );
+		}
+
+		apply_gain(buf_L, buf_R, nframes, _gain);
+
+		if( _bypass != BYPASS_OFF ) {
+			// The direct path decides when the song is over
+			if( _bypass_pos >= _song_length ) {
+				_playing = false;
+				_position = 0;
+				_bypass_pos = 0;
+				_bypass = BYPASS_OFF;
+				_stretcher->reset();
+			}
+		} else {
+			if(_position >= _song_length) {
+				_hit_end = true;
+			}
+			if( (_hit_end == true) && (read_space == 0) && (_seek == SEEK_IDLE) ) {
+				_hit_end = false;
+				_playing = false;
+				_position = 0;
+				_stretcher->reset();
+			}
+		}
 
-		uint32_t frame;
-		uint32_t reqd, gend, zeros, feed;
+		// Wake up, lazybones!
+		_stretcher->nudge();
+		if( _seek != SEEK_IDLE ) {
+			_standby->nudge();
+		}
+	}
 
-		assert( _stretcher.is_running() );
+	/**
+	 * Push song data into a stretcher, observing A/B loop points.
+	 * [RT SAFE]
+	 *
+	 * \param position where to read the song.  Advanced.
+	 */
+	uint32_t Engine::_feed(RubberBandServer *stretcher, unsigned long& position)
+	{
+		// MUTEX MUST ALREADY BE LOCKED
+		uint32_t feed, total = 0;
 
 		// Determine how much data to push into the stretcher
 		int32_t write_space, written, input_frames;
-		write_space = _stretcher.available_write();
-		written = _stretcher.written();
-		if(written < _stretcher.feed_block_min()
-		   && write_space >= _stretcher.feed_block_max() ) {
-			input_frames = _stretcher.feed_block_max();
+		write_space = stretcher->available_write();
+		written = stretcher->written();
+		if(written < stretcher->feed_block_min()
+		   && write_space >= stretcher->feed_block_max() ) {
+			input_frames = stretcher->feed_block_max();
 		} else {
 			input_frames = 0;
 		}
@@ -201,104 +525,794 @@ namespace StretchPlayer
 		int shiftInFrames = _shift * _sample_rate;
 		while( input_frames > 0 ) {
 			feed = input_frames;
-			if( looping() && ((_position + feed) >= _loop_b) ) {
-			if( _position >= _loop_b ) {
-				_position = _loop_a;
+			if( looping() && ((position + feed) >= _loop_b) ) {
+			if( position >= _loop_b ) {
+				position = _loop_a;
 				if( _loop_a + feed > _loop_b ) {
 				assert(_loop_b > _loop_a );
 				feed = _loop_b - _loop_a;
 				}
 			} else {
-				assert( _loop_b >= _position );
-				feed = _loop_b - _position;
+				assert( _loop_b >= position );
+				feed = _loop_b - position;
 			}
 			}
-			if( _position + feed > _left.size() ) {
-			feed = _left.size() - _position;
+			if( position + feed > _song_length ) {
+			feed = _song_length - position;
 			input_frames = feed;
 			}
-			if (_shift) {
-				float *cand = &_null[0];
-				if (_shift > 0) { 
-					// actual position at the left channel
-					if (_left.size() > (_position + shiftInFrames))
-						cand = &_right[_position + shiftInFrames];
+			if( feed > FEED_SCRATCH_SIZE ) {
+			feed = FEED_SCRATCH_SIZE;
+			}
+			float *left = &_feed_left[0], *right = &_feed_right[0];
+			uint32_t got = _song->read(position, shiftInFrames, left, right, feed);
+			if( got < feed ) {
+			// Song can't deliver yet (e.g. streaming, or still
+			// loading).  Try again next cycle.
+			if( !_starved ) {
+				_starved = true;
+				++_underruns;
+			}
+			feed = got;
+			input_frames = got;
+			} else {
+			_starved = false;
+			}
+			if( feed ) {
+			stretcher->write_audio( left, right, feed );
+			}
+			position += feed;
+			total += feed;
+			assert( input_frames >= feed );
+			input_frames -= feed;
+			if( looping() && position >= _loop_b ) {
+			position = _loop_a;
+			}
+		}
+		return total;
+	}
 
-					_stretcher.write_audio( &_left[_position], cand, feed );
+	/**
+	 * Free-running: wait until _stretcher has nframes of output, or
+	 * it has had the whole song, feeding it meanwhile.  Then the
+	 * output doesn't depend on how fast the worker thread is.
+	 * [NOT RT SAFE]
+	 *
+	 * \return frames fed
+	 */
+	uint32_t Engine::_wait_for_stretcher(uint32_t nframes)
+	{
+		// MUTEX MUST ALREADY BE LOCKED
+		uint32_t fed = 0, n;
+
+		while( true ) {
+			_stretcher->sync(nframes);
+			if( _stretcher->available_read() >= nframes ) {
+				break;
+			}
+			n = _feed(_stretcher, _position);
+			if( n == 0 ) {
+				if( !looping() && _position >= _song_length ) {
+					break;
 				}
-				else {
-					// actual position at the right channel
-					if (_left.size() > (_position - shiftInFrames))
-						cand = &_left[_position - shiftInFrames];
-					_stretcher.write_audio( cand, &_right[_position], feed );
+				// Still loading (--stream, --progressive)
+				std::this_thread::yield();
+			}
+			fed += n;
+		}
+		return fed;
+	}
+
+	/**
+	 * Throw away up to count frames of a stretcher's output (its
+	 * pre-roll). [RT SAFE]
+	 *
+	 * \param count frames still to drop.  Decreased.
+	 */
+	void Engine::_drop(RubberBandServer *stretcher, uint32_t& count)
+	{
+		// MUTEX MUST ALREADY BE LOCKED
+		uint32_t n;
+
+		while( count ) {
+			n = stretcher->available_read();
+			if( n > count ) n = count;
+			if( n > FEED_SCRATCH_SIZE ) n = FEED_SCRATCH_SIZE;
+			if( n == 0 ) break;
+			float *left = &_feed_left[0], *right = &_feed_right[0];
+			stretcher->read_audio(left, right, n);
+			count -= n;
+		}
+	}
+
+	/**
+	 * Start crossfading to _seek_target. [RT SAFE]
+	 *
+	 * A seek that arrives during another one finishes that one at
+	 * once.  While the bypass is switching, there's nothing to
+	 * crossfade from, so it falls back to a reset.  So does a
+	 * song that can only be read at one place (_single_reader).
+	 */
+	void Engine::_start_seek()
+	{
+		// MUTEX MUST ALREADY BE LOCKED
+		if( _single_reader ) {
+			_loop_cache = LOOP_CACHE_IDLE;
+			_loop_cache_fed = 0;
+			if( _bypass == BYPASS_ON ) {
+				_bypass_pos = _output_position = _seek_target;
+			} else {
+				_stretcher->reset();
+				_position = _output_position = _seek_target;
+				_hit_end = false;
+			}
+			return;
+		}
+		if( _seek == SEEK_FADING ) {
+			_finish_seek();
+			if( _loop_cache == LOOP_CACHE_LEAVING ) {
+				_loop_cache = LOOP_CACHE_IDLE;
+			}
+		}
+		_seek = SEEK_IDLE;
+		if( _loop_cache == LOOP_CACHE_RECORDING ) {
+			_loop_cache = LOOP_CACHE_IDLE;
+		}
+		_loop_cache_fed = 0;
+
+		switch(_bypass) {
+		case BYPASS_OFF:
+			// If the loop cache is playing, it keeps on
+			// until _standby is ready.
+			if( _loop_cache != LOOP_CACHE_IDLE ) {
+				_loop_cache = LOOP_CACHE_LEAVING;
+			}
+			_standby->reset();
+			_seek_pos = _seek_target;
+			_seek_discard = _standby->latency();
+			_seek_xfade = 0;
+			_seek = SEEK_PRIMING;
+			break;
+		case BYPASS_ON:
+			_seek_old_pos = _bypass_pos;
+			_bypass_pos = _seek_target;
+			_seek_xfade = 0;
+			_seek = SEEK_DIRECT;
+			break;
+		default:
+			_stretcher->reset();
+			_position = _output_position = _seek_target;
+			_hit_end = false;
+			_bypass = BYPASS_ENTERING;
+			_bypass_pos = _seek_target;
+			_xfade = 0;
+			break;
+		}
+	}
+
+	/**
+	 * dst = dst * fade-out + src * fade-in, over the seek crossfade
+	 * from frame x on.
+	 */
+	static void equal_power_mix(float *dst, const float *src, uint32_t nframes,
+				    uint32_t x, const float *curve, uint32_t len)
+	{
+		uint32_t k;
+		for( k=0 ; k<nframes && x<len ; ++k, ++x ) {
+			dst[k] = dst[k] * curve[len - x] + src[k] * curve[x];
+		}
+		if( k < nframes ) {
+			memcpy(dst + k, src + k, (nframes - k) * sizeof(float));
+		}
+	}
+
+	/**
+	 * Bypass seek: crossfade from _seek_old_pos to _bypass_pos.
+	 * [RT SAFE]
+	 */
+	void Engine::_seek_direct(float *buf_L, float *buf_R, uint32_t nframes)
+	{
+		// MUTEX MUST ALREADY BE LOCKED
+		unsigned long to = _bypass_pos;
+		uint32_t done = 0, got;
+
+		// The old position first...
+		_bypass_pos = _seek_old_pos;
+		_bypass_mix(buf_L, buf_R, nframes, 0);
+		_seek_old_pos = _bypass_pos;
+		_bypass_pos = to;
+
+		// ...then fade in the new one
+		while( done < nframes ) {
+			float *left = &_feed_left[0], *right = &_feed_right[0];
+			got = _read_direct(left, right, nframes - done);
+			if( got == 0 ) {
+				// Nothing there (e.g. the end of the song)
+				got = nframes - done;
+				if( got > FEED_SCRATCH_SIZE ) got = FEED_SCRATCH_SIZE;
+				left = &_feed_left[0];
+				right = &_feed_right[0];
+				memset(left, 0, got * sizeof(float));
+				memset(right, 0, got * sizeof(float));
+			}
+			equal_power_mix(buf_L + done, left, got, _seek_xfade + done, &_seek_curve[0], SEEK_XFADE);
+			equal_power_mix(buf_R + done, right, got, _seek_xfade + done, &_seek_curve[0], SEEK_XFADE);
+			done += got;
+		}
+
+		_seek_xfade += nframes;
+		if( _seek_xfade >= SEEK_XFADE ) {
+			_seek = SEEK_IDLE;
+		}
+	}
+
+	/**
+	 * Stretcher seek: drop _standby's pre-roll, then crossfade it
+	 * over _stretcher's output in the buffers. [RT SAFE]
+	 */
+	void Engine::_pull_standby(float *buf_L, float *buf_R, uint32_t nframes)
+	{
+		// MUTEX MUST ALREADY BE LOCKED
+		uint32_t done = 0, got, n;
+
+		if( _seek == SEEK_PRIMING ) {
+			_drop(_standby, _seek_discard);
+			if( _seek_discard
+			    || (_standby->available_read() < nframes && _seek_pos < _song_length) ) {
+				return;
+			}
+			_seek = SEEK_FADING;
+			_seek_xfade = 0;
+		}
+
+		while( done < nframes ) {
+			float *left = &_feed_left[0], *right = &_feed_right[0];
+			n = nframes - done;
+			if( n > FEED_SCRATCH_SIZE ) n = FEED_SCRATCH_SIZE;
+			got = _standby->read_audio(left, right, n);
+			memset(left + got, 0, (n - got) * sizeof(float));
+			memset(right + got, 0, (n - got) * sizeof(float));
+			equal_power_mix(buf_L + done, left, n, _seek_xfade + done, &_seek_curve[0], SEEK_XFADE);
+			equal_power_mix(buf_R + done, right, n, _seek_xfade + done, &_seek_curve[0], SEEK_XFADE);
+			done += n;
+		}
+
+		_seek_xfade += nframes;
+		if( _seek_xfade >= SEEK_XFADE ) {
+			_finish_seek();
+		}
+	}
+
+	/**
+	 * \return true if the settings that the loop cache depends on
+	 * have changed since the last call.
+	 */
+	bool Engine::_loop_cache_key_changed()
+	{
+		// MUTEX MUST ALREADY BE LOCKED
+		loop_cache_key_t key;
+		bool changed;
+
+		key.stretch = _stretch;
+		key.pitch = _pitch;
+		key.shift = _shift;
+		key.loop_a = _loop_a;
+		key.loop_b = _loop_b;
+		changed = key.stretch != _loop_cache_key.stretch
+			|| key.pitch != _loop_cache_key.pitch
+			|| key.shift != _loop_cache_key.shift
+			|| key.loop_a != _loop_cache_key.loop_a
+			|| key.loop_b != _loop_cache_key.loop_b;
+		_loop_cache_key = key;
+		return changed;
+	}
+
+	/**
+	 * Bring a song position into the A/B loop (if there is one).
+	 */
+	unsigned long Engine::_loop_wrap(double pos)
+	{
+		// MUTEX MUST ALREADY BE LOCKED
+		if( !looping() ) {
+			if( pos < 0 ) return 0;
+			if( pos > _song_length ) return _song_length;
+			return pos;
+		}
+		double len = _loop_b - _loop_a;
+		pos = ::fmod(pos - _loop_a, len);
+		if( pos < 0 ) pos += len;
+		return _loop_a + (unsigned long)pos;
+	}
+
+	/**
+	 * Record the stretcher's output while an A/B loop plays at
+	 * steady settings, and switch to playing the recording once
+	 * it's complete. [RT SAFE]
+	 *
+	 * \param pulled false if the stretcher couldn't fill the buffers
+	 * \param fed input frames fed to the stretcher this cycle
+	 */
+	void Engine::_loop_cache_record(const float *buf_L, const float *buf_R, uint32_t nframes,
+					bool pulled, uint32_t fed)
+	{
+		// MUTEX MUST ALREADY BE LOCKED
+		bool changed = _loop_cache_key_changed();
+		uint32_t n, k;
+		float w;
+
+		if( !looping() || _bypass != BYPASS_OFF || _seek != SEEK_IDLE
+		    || !_loop_cache_allocated.load(std::memory_order_acquire)
+		    || changed || !pulled ) {
+			// Start over
+			_loop_cache = LOOP_CACHE_IDLE;
+			_loop_cache_fed = 0;
+			return;
+		}
+
+		if( _loop_cache == LOOP_CACHE_IDLE ) {
+			_loop_cache_fed += fed;
+
+			// Wait until the output only depends on input that
+			// was fed at these settings.
+			float ratio = _audio_system->sample_rate() / _sample_rate / _stretch;
+			double lag = double(_stretcher->written()) + _stretcher->latency()
+				+ (_stretcher->available_read() + nframes) / ratio;
+			if( _loop_cache_fed < 2 * (lag + _stretcher->feed_block_max()) ) {
+				return;
+			}
+			double period = (_loop_b - _loop_a) * ratio;
+			if( period < 4 * BYPASS_XFADE || period + BYPASS_XFADE > _loop_cache_capacity ) {
+				return;
+			}
+			_loop_cache_period = period + 0.5;
+			_loop_cache_ratio = ratio;
+			_loop_cache_in0 = _loop_wrap(double(_position) - lag);
+			_loop_cache_fill = 0;
+			_loop_cache = LOOP_CACHE_RECORDING;
+		}
+
+		n = _loop_cache_period + BYPASS_XFADE - _loop_cache_fill;
+		if( n > nframes ) n = nframes;
+		memcpy(&_loop_cache_buf[0][_loop_cache_fill], buf_L, n * sizeof(float));
+		memcpy(&_loop_cache_buf[1][_loop_cache_fill], buf_R, n * sizeof(float));
+		_loop_cache_fill += n;
+		if( _loop_cache_fill < _loop_cache_period + BYPASS_XFADE ) {
+			return;
+		}
+
+		// The frames past the end of the period would have
+		// followed on from its last frame.  Fade them into the
+		// start, so that the wrap is seamless.
+		for( k=0 ; k<BYPASS_XFADE ; ++k ) {
+			w = _xfade_curve[k];
+			_loop_cache_buf[0][k] = _loop_cache_buf[0][_loop_cache_period + k] * (1.0f - w)
+				+ _loop_cache_buf[0][k] * w;
+			_loop_cache_buf[1][k] = _loop_cache_buf[1][_loop_cache_period + k] * (1.0f - w)
+				+ _loop_cache_buf[1][k] * w;
+		}
+		_loop_cache_idx = (BYPASS_XFADE + nframes - n) % _loop_cache_period;
+		_loop_cache = LOOP_CACHE_PLAYING;
+
+		// The stretcher isn't needed until something changes.
+		_stretcher->reset();
+	}
+
+	/**
+	 * Play the A/B loop out of the cache. [RT SAFE]
+	 */
+	void Engine::_loop_cache_play(float *buf_L, float *buf_R, uint32_t nframes)
+	{
+		// MUTEX MUST ALREADY BE LOCKED
+		uint32_t done = 0, n;
+
+		while( done < nframes ) {
+			n = _loop_cache_period - _loop_cache_idx;
+			if( n > nframes - done ) n = nframes - done;
+			memcpy(buf_L + done, &_loop_cache_buf[0][_loop_cache_idx], n * sizeof(float));
+			memcpy(buf_R + done, &_loop_cache_buf[1][_loop_cache_idx], n * sizeof(float));
+			done += n;
+			_loop_cache_idx += n;
+			if( _loop_cache_idx >= _loop_cache_period ) {
+				_loop_cache_idx = 0;
+			}
+		}
+
+		// Where that is in the song
+		double len = _loop_cache_key.loop_b - _loop_cache_key.loop_a;
+		double pos = _loop_cache_in0 - _loop_cache_key.loop_a
+			+ _loop_cache_idx / _loop_cache_ratio;
+		_output_position = _loop_cache_key.loop_a + (unsigned long)::fmod(pos, len);
+	}
+
+	/**
+	 * Stop using the loop cache.  It keeps playing while _standby
+	 * pre-rolls from the same place. [RT SAFE]
+	 *
+	 * A _single_reader song can't be pre-rolled while the cache
+	 * plays without the two reads fighting, so _stretcher just
+	 * starts over from there, and its latency is a gap.
+	 */
+	void Engine::_loop_cache_leave()
+	{
+		// MUTEX MUST ALREADY BE LOCKED
+		uint32_t lat = _standby->latency();
+
+		if( _single_reader ) {
+			_stretcher->reset();
+			_position = _loop_wrap(_output_position);
+			_hit_end = false;
+			_loop_cache = LOOP_CACHE_IDLE;
+			_loop_cache_fed = 0;
+			return;
+		}
+
+		_standby->reset();
+		_seek_pos = _loop_wrap(double(_output_position) + lat);
+		_seek_discard = lat;
+		_seek_xfade = 0;
+		_seek = SEEK_PRIMING;
+		_loop_cache = LOOP_CACHE_LEAVING;
+	}
+
+	/**
+	 * Make _standby the stretcher being heard. [RT SAFE]
+	 */
+	void Engine::_finish_seek()
+	{
+		// MUTEX MUST ALREADY BE LOCKED
+		std::swap(_stretcher, _standby);
+		_position = _seek_pos;
+		_hit_end = false;
+		_standby->reset();
+		_seek = SEEK_IDLE;
+	}
+
+	/**
+	 * Switch in and out of bypass as the settings change. [RT SAFE]
+	 *
+	 * \param unity true if the stretcher would leave the audio
+	 * as it is.
+	 */
+	void Engine::_update_bypass(bool unity)
+	{
+		// MUTEX MUST ALREADY BE LOCKED
+		if( _seek != SEEK_IDLE ) {
+			// Let the seek finish first
+			return;
+		}
+		switch(_bypass) {
+		case BYPASS_OFF:
+			if( unity ) {
+				// Start the direct path where the stretcher's
+				// output is now.  At unity, output frames are
+				// input frames.
+				unsigned long behind = _stretcher->written() + _stretcher->latency()
+					+ _stretcher->available_read();
+				_bypass_pos = (_position > behind) ? (_position - behind) : 0;
+				if( looping() && _bypass_pos < _loop_a ) {
+					_bypass_pos = _loop_a;
+				}
+				_xfade = 0;
+				_bypass = BYPASS_ENTERING;
+				if( _single_reader ) {
+					// No crossfade.  The song jumps back
+					// to _bypass_pos, with a short gap.
+					_stretcher->reset();
+					_bypass = BYPASS_ON;
 				}
 			}
-			else {
-				_stretcher.write_audio( &_left[_position], &_right[_position], feed );
+			break;
+		case BYPASS_ENTERING:
+			if( !unity ) {
+				_bypass = BYPASS_OFF;
 			}
-			_position += feed;
-			assert( input_frames >= feed );
-			input_frames -= feed;
-			if( looping() && _position >= _loop_b ) {
-			_position = _loop_a;
+			break;
+		case BYPASS_ON:
+			if( !unity && _single_reader ) {
+				// Carry on from the same read position.  The
+				// stretcher's latency comes out as a gap.
+				_stretcher->reset();
+				_position = _bypass_pos;
+				_hit_end = false;
+				_bypass = BYPASS_OFF;
+			} else if( !unity ) {
+				// Prime the stretcher ahead of the direct path
+				// by its latency, so that its first real output
+				// lines up with the direct path.
+				uint32_t lat = _stretcher->latency();
+				_bypass_target = _bypass_pos + lat;
+				if( _bypass_target > _song_length
+				    || (looping() && _bypass_target >= _loop_b) ) {
+					_bypass_target = _bypass_pos;
+					lat = 0;
+				}
+				_stretcher->reset();
+				_position = _bypass_target;
+				_discard = lat;
+				_xfade = 0;
+				_hit_end = false;
+				_bypass = BYPASS_LEAVING;
 			}
+			break;
+		case BYPASS_LEAVING:
+			if( unity ) {
+				_stretcher->reset();
+				_bypass = BYPASS_ON;
+			}
+			break;
 		}
+	}
 
-		// Pull generated data off the stretcher
-		uint32_t read_space;
-		read_space = _stretcher.available_read();
+	/**
+	 * Read the song at _bypass_pos, observing A/B loop points.
+	 * [RT SAFE]
+	 *
+	 * Like Song::read(), left and right are scratch buffers of at
+	 * least FEED_SCRATCH_SIZE, and may be pointed at the song's
+	 * storage instead.
+	 *
+	 * \return frames read.  0 at the end of the song, or if the
+	 * song can't deliver yet.
+	 */
+	uint32_t Engine::_read_direct(float *&left, float *&right, uint32_t count)
+	{
+		// MUTEX MUST ALREADY BE LOCKED
+		uint32_t got;
 
-		if( read_space >= nframes ) {
-			_stretcher.read_audio(buf_L, buf_R, nframes);
-		} else if ( (read_space > 0) && _hit_end ) {
-			_zero_buffers(nframes);
-			_stretcher.read_audio(buf_L, buf_R, read_space);
+		if( looping() && _bypass_pos >= _loop_b ) {
+			_bypass_pos = _loop_a;
+		}
+		if( looping() && _bypass_pos + count > _loop_b ) {
+			count = _loop_b - _bypass_pos;
+		}
+		if( _bypass_pos >= _song_length ) {
+			return 0;
+		}
+		if( _bypass_pos + count > _song_length ) {
+			count = _song_length - _bypass_pos;
+		}
+		if( count > FEED_SCRATCH_SIZE ) {
+			count = FEED_SCRATCH_SIZE;
+		}
+		got = _song->read(_bypass_pos, _shift * _sample_rate, left, right, count);
+		if( got < count ) {
+			if( !_starved ) {
+				_starved = true;
+				++_underruns;
+			}
 		} else {
-			_zero_buffers(nframes);
+			_starved = false;
 		}
+		_bypass_pos += got;
+		return got;
+	}
 
-		// Update our estimation of the output position.
-		unsigned n_feed_buf = _stretcher.latency();
-		if(_position > n_feed_buf) {
-			_output_position = _position - n_feed_buf;
+	/**
+	 * Put the song, read directly at _bypass_pos, into the output
+	 * buffers. [RT SAFE]
+	 *
+	 * \param fade 0 to overwrite the buffers (bit exact), 1 to
+	 * fade the direct path in over what's there, -1 to fade it
+	 * out.  The position in the fade is _xfade.
+	 */
+	void Engine::_bypass_mix(float *buf_L, float *buf_R, uint32_t nframes, int fade)
+	{
+		// MUTEX MUST ALREADY BE LOCKED
+		uint32_t done = 0, got, k, x;
+		float w;
+
+		while( done < nframes ) {
+			float *left = &_feed_left[0], *right = &_feed_right[0];
+			got = _read_direct(left, right, nframes - done);
+			if( got == 0 ) {
+				break;
+			}
+			if( fade == 0 ) {
+				memcpy(buf_L + done, left, got * sizeof(float));
+				memcpy(buf_R + done, right, got * sizeof(float));
+			} else {
+				for( k=0 ; k<got ; ++k ) {
+					x = _xfade + done + k;
+					w = (x < BYPASS_XFADE) ? _xfade_curve[x] : 1.0f;
+					if( fade < 0 ) w = 1.0f - w;
+					buf_L[done + k] += w * (left[k] - buf_L[done + k]);
+					buf_R[done + k] += w * (right[k] - buf_R[done + k]);
+				}
+			}
+			done += got;
+		}
+
+		// Past the end, or starved: the direct path is silent
+		if( fade == 0 ) {
+			memset(buf_L + done, 0, (nframes - done) * sizeof(float));
+			memset(buf_R + done, 0, (nframes - done) * sizeof(float));
+			return;
+		}
+		for( k=done ; k<nframes ; ++k ) {
+			x = _xfade + k;
+			w = (x < BYPASS_XFADE) ? _xfade_curve[x] : 1.0f;
+			if( fade < 0 ) w = 1.0f - w;
+			buf_L[k] *= 1.0f - w;
+			buf_R[k] *= 1.0f - w;
+		}
+	}
+
+	/**
+	 * Get the stretcher's output while leaving bypass. [RT SAFE]
+	 *
+	 * Drops the stretcher's pre-roll, then waits until the direct
+	 * path has caught up with the point the stretcher was primed
+	 * at.
+	 *
+	 * \return true if the buffers now hold stretcher output and
+	 * the crossfade should go on.
+	 */
+	bool Engine::_pull_leaving(float *buf_L, float *buf_R, uint32_t nframes)
+	{
+		// MUTEX MUST ALREADY BE LOCKED
+		uint32_t n;
+
+		while( _discard ) {
+			n = _stretcher->available_read();
+			if( n > _discard ) n = _discard;
+			if( n > FEED_SCRATCH_SIZE ) n = FEED_SCRATCH_SIZE;
+			if( n == 0 ) break;
+			float *left = &_feed_left[0], *right = &_feed_right[0];
+			_stretcher->read_audio(left, right, n);
+			_discard -= n;
+		}
+
+		if( _xfade == 0
+		    && (_discard || _bypass_pos < _bypass_target
+			|| _stretcher->available_read() < nframes) ) {
+			return false;
+		}
+		if( _stretcher->available_read() >= nframes ) {
+			_stretcher->read_audio(buf_L, buf_R, nframes);
 		} else {
-			_output_position = 0;
+			_zero_buffers(nframes);
 		}
-		assert( (_output_position > _position) ? (_output_position - _position) <= n_feed_buf : true );
-		assert( (_output_position < _position) ? (_position - _output_position) <= n_feed_buf : true );
+		return true;
+	}
 
-		// Apply gain... unroll loop manually so GCC will use SSE
-		if(nframes & 0xf) {  // nframes < 16
-			unsigned f = nframes;
-			while(f--) {
-			(*buf_L++) *= _gain;
-			(*buf_R++) *= _gain;
+	/**
+	 * Open a file for streaming from disk
+	 *
+	 * \return the song, or 0 on failure
+	 */
+	Song* Engine::_load_song_streaming(const char *filename)
+	{
+		char err[1024] = "";
+		std::unique_ptr<DiskStreamer> streamer(new DiskStreamer);
+
+		_message("Opening file...");
+		if( ! streamer->open(filename, _config->read_ahead(), std::abs(_shift),
+				     _config->mono(), err, sizeof(err)) ) {
+			_error(err);
+			return 0;
+		}
+		_max_shift = streamer->max_shift() / streamer->sample_rate();
+		return streamer.release();
+	}
+
+	/* Smallest range of frames worth giving its own decoder. */
+	static const unsigned long MIN_DECODE_CHUNK = 1 << 18;
+
+	typedef std::function<unsigned long (unsigned long, unsigned long)> decode_job_t;
+
+	/**
+	 * How to split a file of the given length among the cores.
+	 *
+	 * \return frames per chunk
+	 */
+	static unsigned long decode_chunk_size(unsigned long frames, bool seekable)
+	{
+		unsigned long n = std::thread::hardware_concurrency();
+
+		if( !seekable || n < 1 ) n = 1;
+		if( n > frames / MIN_DECODE_CHUNK ) n = frames / MIN_DECODE_CHUNK;
+		if( n < 1 ) n = 1;
+		return (frames + n - 1) / n;
+	}
+
+	/**
+	 * Decode [0, frames) in parallel
+	 *
+	 * job(start, count) is run on each chunk by its own thread.
+	 * Each job decodes its chunk with its own decoder handle,
+	 * straight into its slice of the output buffers, and returns
+	 * the number of frames decoded.
+	 *
+	 * If idle is set, the calling thread calls it every 10 ms until
+	 * the jobs are done.  Otherwise it decodes the first chunk.
+	 *
+	 * \return frames decoded from the start of the file up to the
+	 * first chunk that came up short.
+	 */
+	static unsigned long decode_in_parallel(unsigned long frames, unsigned long chunk,
+						const decode_job_t& job,
+						const std::function<void ()>& idle)
+	{
+		unsigned long n = (frames + chunk - 1) / chunk;
+		std::vector<unsigned long> got(n, 0);
+		std::vector<std::thread> workers;
+		std::atomic<unsigned long> running(n);
+		unsigned long k;
+
+		for( k = (idle) ? 0 : 1 ; k < n ; ++k ) {
+			unsigned long start = k * chunk;
+			unsigned long count = std::min(chunk, frames - start);
+			workers.push_back( std::thread([&job, &got, &running, k, start, count]() {
+				got[k] = job(start, count);
+				--running;
+			}) );
+		}
+		if( idle ) {
+			while( running.load() ) {
+				idle();
+				usleep(10000);
 			}
 		} else {
-			apply_gain_to_buffer(buf_L, nframes, _gain);
-			apply_gain_to_buffer(buf_R, nframes, _gain);
+			got[0] = job(0, std::min(chunk, frames));
 		}
-
-		if(_position >= _left.size()) {
-			_hit_end = true;
+		for( k = 0 ; k < workers.size() ; ++k ) {
+			workers[k].join();
 		}
-		if( (_hit_end == true) && (read_space == 0) ) {
-			_hit_end = false;
-			_playing = false;
-			_position = 0;
-			_stretcher.reset();
+
+		unsigned long total = 0;
+		for( k = 0 ; k < n ; ++k ) {
+			total += got[k];
+			if( got[k] < std::min(chunk, frames - k * chunk) ) break;
 		}
+		return total;
+	}
 
-		// Wake up, lazybones!
-		_stretcher.nudge();
+	/**
+	 * Decode count frames from sf into the song, starting at frame
+	 * start.  Only the first two channels are kept.
+	 *
+	 * \return frames read
+	 */
+	static unsigned long read_sndfile_range(SNDFILE *sf, int channels, MemorySong *song,
+						unsigned long start, unsigned long count)
+	{
+		std::vector<float> buf(DECODE_BLOCK * channels, 0.0f);
+		std::vector<float> scratch(DECODE_BLOCK * 2);
+		int nplanar = (channels > 1) ? 2 : 1;
+		float *planar[2];
+		sf_count_t read;
+		unsigned long pos = 0;
+
+		while( pos < count && !song->cancelled() ) {
+			read = count - pos;
+			if( read > DECODE_BLOCK ) read = DECODE_BLOCK;
+			read = sf_readf_float(sf, &buf[0], read);
+			if( read < 1 ) break;
+			planar[0] = song->write_buffer(0, start + pos, &scratch[0]);
+			planar[1] = (nplanar > 1) ? song->write_buffer(1, start + pos, &scratch[DECODE_BLOCK]) : 0;
+			bams_deinterleave_float(planar, nplanar, &buf[0], channels, read);
+			song->commit(0, start + pos, planar[0], read);
+			if( nplanar > 1 )
+				song->commit(1, start + pos, planar[1], read);
+			pos += read;
+			song->set_filled(start, start + pos);
+		}
+		return pos;
 	}
 
 	/**
 	 * Attempt to load a file via libsndfile
 	 *
+	 * Seekable files are decoded in parallel, one SNDFILE per
+	 * thread.
+	 *
+	 * \param ready if set, the song is handed to the audio thread
+	 * as soon as decoding starts.  See _post_progressive().
+	 *
 	 * \return true on success
 	 */
-	bool Engine::_load_song_using_libsndfile(const char *filename)
+	bool Engine::_load_song_using_libsndfile(const char *filename, MemorySong *song,
+						 std::promise<bool> *ready)
 	{
 		SNDFILE *sf = 0;
 		SF_INFO sf_info;
@@ -315,11 +1329,6 @@ namespace StretchPlayer
 			return false;
 		}
 
-		_sample_rate = sf_info.samplerate;
-		_left.reserve( sf_info.frames );
-		_right.reserve( sf_info.frames );
-		_null.resize( sf_info.frames, 0.f );
-
 		if(sf_info.frames == 0) {
 			char tmp[512] = "Error opening file '";
 			strcat(tmp, filename);
@@ -328,45 +1337,120 @@ namespace StretchPlayer
 			sf_close(sf);
 			return false;
 		}
-		_channelCount = sf_info.channels;
+		song->set_format(sf_info.samplerate, sf_info.channels);
 
 		_message("Reading file...");
-		std::vector<float> buf(4096, 0.0f);
-		sf_count_t read, k;
-		unsigned mod;
-		while(true) {
-			read = sf_read_float(sf, &buf[0], buf.size());
-			if( read < 1 ) break;
-			for(k=0 ; k<read ; ++k) {
-			mod = k % sf_info.channels;
-			if( mod == 0 ) {
-				_left.push_back( buf[k] );
-				if (sf_info.channels == 1) // mono
-					_right.push_back( buf[k] );
-			} else if( mod == 1 ) {
-				_right.push_back( buf[k] );
-			} else {
-				// remaining channels ignored
-			}
-			}
-		}
+		int channels = sf_info.channels;
+		unsigned long chunk = decode_chunk_size(sf_info.frames, sf_info.seekable);
+		sf_count_t pos;
+
+		song->resize( sf_info.frames );
+		if( ready )
+			_post_progressive(song, chunk, ready);
+		pos = decode_in_parallel(sf_info.frames, chunk,
+			[&](unsigned long start, unsigned long count) -> unsigned long {
+				SNDFILE *h = sf;
+				SF_INFO info;
+				unsigned long got = 0;
+				if( start ) {
+					memset(&info, 0, sizeof(info));
+					h = sf_open(filename, SFM_READ, &info);
+					if( !h ) return 0;
+					if( sf_seek(h, start, SEEK_SET) != sf_count_t(start) ) {
+						sf_close(h);
+						return 0;
+					}
+				}
+				got = read_sndfile_range(h, channels, song, start, count);
+				if( start ) sf_close(h);
+				return got;
+			},
+			_progressive_idle(ready));
 
-		if( _left.size() != sf_info.frames ) {
+		if( pos != sf_info.frames && !song->cancelled() ) {
 			_error("Warning: not all of the file data was read.");
 		}
+		_finish_song(song, pos, ready);
 
 		sf_close(sf);
 		return true;
 	}
 
+	/**
+	 * Open filename with mpg123, locked to the given output format.
+	 *
+	 * \return the handle, or 0 on failure
+	 */
+	static mpg123_handle* open_mpg123(const char *filename, long rate, int channels, int encoding)
+	{
+		mpg123_handle *mh = mpg123_new(0, 0);
+		if( !mh ) return 0;
+		Mpg123::lock_format(mh, rate, channels, encoding);
+		if( mpg123_open(mh, filename) != MPG123_OK ) {
+			mpg123_delete(mh);
+			return 0;
+		}
+		return mh;
+	}
+
+	/**
+	 * Decode count frames from mh into the song, starting at frame
+	 * start.  Only the first two channels are kept.
+	 *
+	 * \param err set to the last mpg123 return code
+	 * \return frames read
+	 */
+	static unsigned long read_mpg123_range(mpg123_handle *mh, int channels, int encoding,
+					       MemorySong *song, unsigned long start,
+					       unsigned long count, int& err)
+	{
+		size_t frame_bytes = Mpg123::frame_bytes(encoding, channels);
+		std::vector<double> buffer((MPG123_BLOCK * frame_bytes + sizeof(double) - 1) / sizeof(double));
+		std::vector<float> scratch(MPG123_BLOCK * 2);
+		std::vector<float> convert;
+		int nplanar = (channels > 1) ? 2 : 1;
+		float *planar[2];
+		size_t read = 0, want;
+		unsigned long pos = 0;
+
+		err = MPG123_OK;
+		while( pos < count && !song->cancelled() ) {
+			want = std::min<unsigned long>(MPG123_BLOCK, count - pos);
+			err = mpg123_read(mh, (unsigned char*)&buffer[0], want * frame_bytes, &read);
+			if (err != MPG123_OK && err != MPG123_DONE)
+				break;
+			read /= frame_bytes;
+			if (read > 0) {
+				planar[0] = song->write_buffer(0, start + pos, &scratch[0]);
+				planar[1] = (nplanar > 1) ? song->write_buffer(1, start + pos, &scratch[MPG123_BLOCK]) : 0;
+				Mpg123::deinterleave(planar, nplanar, &buffer[0], encoding, channels, read, convert);
+				song->commit(0, start + pos, planar[0], read);
+				if( nplanar > 1 )
+					song->commit(1, start + pos, planar[1], read);
+				pos += read;
+				song->set_filled(start, start + pos);
+			}
+			if (err == MPG123_DONE)
+				break;
+		}
+		return pos;
+	}
+
 	/**
 	 * Attempt to load an MP3 file via libmpg123
 	 *
 	 * adapted by Sean Bolton from mpg123_to_wav.c
 	 *
+	 * The file is scanned first, which gives the exact length and
+	 * a frame index.  The index is shared with one handle per
+	 * thread so that the file can be decoded in parallel.
+	 *
+	 * \param ready see _load_song_using_libsndfile()
+	 *
 	 * \return true on success
 	 */
-	bool Engine::_load_song_using_libmpg123(const char *filename)
+	bool Engine::_load_song_using_libmpg123(const char *filename, MemorySong *song,
+						std::promise<bool> *ready)
 	{
 		mpg123_handle *mh = 0;
 		int err, channels, encoding;
@@ -374,8 +1458,11 @@ namespace StretchPlayer
 		char tmpp[1024] = "Error opening file '";
 
 		_message("Opening file...");
-		if ((err = mpg123_init()) != MPG123_OK ||
-			(mh = mpg123_new(0, &err)) == 0 ||
+		if ((err = Mpg123::init()) == MPG123_OK &&
+			(mh = mpg123_new(0, &err)) != 0) {
+			Mpg123::request_float(mh);
+		}
+		if (mh == NULL ||
 			mpg123_open(mh, filename) != MPG123_OK ||
 			mpg123_getformat(mh, &rate, &channels, &encoding) != MPG123_OK) {
 
@@ -390,95 +1477,309 @@ namespace StretchPlayer
 		  mpg123error:
 			mpg123_close(mh);
 			mpg123_delete(mh);
-			mpg123_exit();
 			return false;
 		}
-		if (encoding != MPG123_ENC_SIGNED_16) {
-			_error("Error: unsupported encoding format.");
-			goto mpg123error;
-		}
-		/* lock the output format */
-		mpg123_format_none(mh);
-		mpg123_format(mh, rate, channels, encoding);
-		_channelCount = channels;
-
+		/* lock the output format (float, unless the library
+		 * can't do it)
+		 */
+		Mpg123::lock_format(mh, rate, channels, encoding);
+
+		/* Without a scan, the length is only an estimate and the
+		 * file can't be split up accurately.
+		 */
+		bool seekable = (mpg123_scan(mh) == MPG123_OK);
 		off_t length = mpg123_length(mh);
 		if (length == MPG123_ERR || length == 0) {
 			_error("Error: file is empty or length unknown.");
 			goto mpg123error;
 		}
 
-		_sample_rate = rate;
-		_left.reserve( length );
-		_right.reserve( length );
-		_null.reserve( length );
+		off_t *index = 0, step = 0;
+		size_t fill = 0;
+		if (seekable && mpg123_index(mh, &index, &step, &fill) != MPG123_OK) {
+			seekable = false;
+		}
 
-		_message("Reading file...");
-		std::vector<signed short> buffer(4096, 0);
-		size_t read = 0, k;
+		song->set_format(rate, channels);
 
-		while (1) {
-			err = mpg123_read(mh, (unsigned char*)&buffer[0], buffer.size(), &read);
-			if (err != MPG123_OK && err != MPG123_DONE)
-			break;
-			if (read > 0) {
-			read /= sizeof(signed short);
-			for(k = 0; k < read ; k++) {
-				unsigned int mod = k % channels;
-				if( mod == 0 ) {
-				_left.push_back( (float)buffer[k] / 32768.0f );
+		_message("Reading file...");
+		unsigned long chunk = decode_chunk_size(length, seekable);
+		int last_err = MPG123_OK;
+		size_t pos;
+
+		song->resize( length );
+		if( ready )
+			_post_progressive(song, chunk, ready);
+		pos = decode_in_parallel(length, chunk,
+			[&](unsigned long start, unsigned long count) -> unsigned long {
+				mpg123_handle *h = mh;
+				unsigned long got;
+				int e;
+				if( start ) {
+					h = open_mpg123(filename, rate, channels, encoding);
+					if( !h ) return 0;
+					mpg123_set_index(h, index, step, fill);
+					if( mpg123_seek(h, start, SEEK_SET) != off_t(start) ) {
+						mpg123_close(h);
+						mpg123_delete(h);
+						return 0;
+					}
 				}
-				if( mod == 1 || channels == 1 ) {
-				_right.push_back( (float)buffer[k] / 32768.0f );
+				got = read_mpg123_range(h, channels, encoding, song, start, count, e);
+				if( start ) {
+					mpg123_close(h);
+					mpg123_delete(h);
+				} else {
+					last_err = e;
 				}
-				/* remaining channels ignored */
-			}
-			}
-			if (err == MPG123_DONE)
-			break;
-		};
+				return got;
+			},
+			_progressive_idle(ready));
 
-		if (err == MPG123_NEED_MORE) {
-			_error("Warning: premature end of MP3 stream");
-			/* allow user to play what we did manage to read */
-		} else if (err != MPG123_DONE) {
+		if (pos == 0 && !ready) {
 			 char tmp[512] = "Error decoding file: ";
-			 strcat(tmp, err == MPG123_ERR ? mpg123_strerror(mh) : mpg123_plain_strerror(err));
+			 strcat(tmp, last_err == MPG123_ERR ? mpg123_strerror(mh) : mpg123_plain_strerror(last_err));
 			 strcat(tmp, ".");
 			 _error(tmp);
 			goto mpg123error;
+		} else if (pos < size_t(length) && !song->cancelled()) {
+			_error("Warning: premature end of MP3 stream");
+			/* allow user to play what we did manage to read */
 		}
+		_finish_song(song, pos, ready);
 
 		mpg123_close(mh);
 		mpg123_delete(mh);
-		mpg123_exit();
 		return true;
 	}
 
+	/**
+	 * Hand a song to the audio thread before it is decoded, and
+	 * let load_song() return.  The decoder keeps going, and the
+	 * audio thread plays whatever is ready.
+	 */
+	void Engine::_post_progressive(MemorySong *song, unsigned long chunk, std::promise<bool> *ready)
+	{
+		song->set_ranges(chunk);
+		_loading = song;
+		if( _post_song(song) ) {
+			// Never picked up.  Stop decoding, and let
+			// _load_song_into_memory() free it.
+			_loading = 0;
+			song->cancel();
+			ready->set_value(false);
+			return;
+		}
+		ready->set_value(true);
+	}
+
+	/**
+	 * Wrap up a song after decoding.  If it came up short, it is
+	 * trimmed... unless the audio thread already has it.  Then the
+	 * rest plays as silence.
+	 */
+	void Engine::_finish_song(MemorySong *song, unsigned long frames, std::promise<bool> *ready)
+	{
+		if( !ready ) {
+			song->resize(frames);
+		}
+		song->set_complete();
+	}
+
+	/**
+	 * While decoding progressively, report underruns.
+	 */
+	std::function<void ()> Engine::_progressive_idle(std::promise<bool> *ready)
+	{
+		if( !ready ) {
+			return std::function<void ()>();
+		}
+		return [this]() {
+			unsigned long n = _underruns.load();
+			if( n != _underruns_reported ) {
+				_underruns_reported = n;
+				_dispatch_message(_underrun_callbacks, "Waiting for the file to load...");
+			}
+		};
+	}
+
+	/**
+	 * Write a decoded song to the cache, if there is one.  This
+	 * runs on _decoder, and stops early if the song is cancelled.
+	 */
+	void Engine::_store_in_cache(const char *filename, MemorySong *song)
+	{
+		if (!_cache || song->cancelled()) {
+			return;
+		}
+		// Mapped songs mix down to mono as they play, just
+		// like this one.
+		char err[1024] = "";
+		_message("Writing cache...");
+		if( ! _cache->store(filename, *song, err) && ! song->cancelled() ) {
+			_error(err);
+		}
+	}
+
+	/**
+	 * Decode a whole file into memory.
+	 *
+	 * \param ready if set, decode progressively and report when
+	 * the song has been handed to the audio thread.  The song is
+	 * then also added to the cache, since this already runs on
+	 * _decoder.
+	 *
+	 * \return the song, or 0 on failure (or if it was handed over)
+	 */
+	MemorySong* Engine::_load_song_into_memory(const char *filename, std::promise<bool> *ready)
+	{
+		MemorySong::storage_t storage = MemorySong::FloatStorage;
+		if (_config && _config->storage() == Configuration::Int16Storage) {
+			storage = MemorySong::Int16Storage;
+		} else if (_config && _config->storage() == Configuration::HalfStorage) {
+			storage = MemorySong::HalfStorage;
+		}
+		std::unique_ptr<MemorySong> mem(new MemorySong(storage));
+
+		mem->set_mono( _config && _config->mono() );
+		if (!_load_song_using_libsndfile(filename, mem.get(), ready)
+		    && !_load_song_using_libmpg123(filename, mem.get(), ready)) {
+			if (ready) {
+				ready->set_value(false);
+			}
+			return 0;
+		}
+
+		if (ready) {
+			_store_in_cache(filename, mem.get());
+			if (_loading.load() == mem.get()) {
+				// The audio thread owns it now.
+				_loading = 0;
+				mem.release();
+			}
+			return 0;
+		}
+		return mem.release();
+	}
+
+	/**
+	 * Post a song for the audio thread, wait (up to 2 sec) for
+	 * it to be swapped in, then free the old song.
+	 *
+	 * \return 0 on success.  If the audio thread never picked the
+	 * song up, it is taken back and returned to the caller.
+	 */
+	Song* Engine::_post_song(Song *song)
+	{
+		// The last post may have stopped waiting just before
+		// the audio thread handed back its old song.
+		delete _old_song.exchange(0);
+
+		// If an earlier song was never picked up, the audio
+		// thread hasn't seen it.
+		delete _next_song.exchange(song);
+
+		for (int k = 0 ; k < 2000 && _next_song.load() ; ++k) {
+			usleep(1000);
+		}
+		if (_next_song.exchange(0)) {
+			_error("Error: the audio system did not pick up the song.");
+			return song;
+		}
+		delete _old_song.exchange(0);
+		return 0;
+	}
+
+	/**
+	 * Stop a progressive load that's still running.
+	 */
+	void Engine::_stop_decoder()
+	{
+		MemorySong *song = _loading.load();
+		if (song) {
+			song->cancel();
+		}
+		if (_decoder.joinable()) {
+			_decoder.join();
+		}
+	}
+
 	/**
 	 * Load a file
 	 *
-	 * \return Name of song
+	 * The file is decoded without holding the audio lock, so
+	 * playback of the current song continues until the new one is
+	 * ready.  Then the audio thread swaps it in, and the old song
+	 * is freed here.
+	 *
+	 * With --progressive, the new song is swapped in as soon as it
+	 * starts decoding, and this returns right away.  The rest is
+	 * decoded in the background.  Either way, the cache is written
+	 * in the background, after the song has been swapped in.
+	 *
+	 * \return true on success
 	 */
 	bool Engine::load_song(const char *filename)
 	{
-		std::lock_guard<std::mutex> lk(_audio_lock);
-		stop();
-		_left.clear();
-		_right.clear();
-		_position = 0;
-		_output_position = 0;
-		_stretcher.reset();
-		bool ok = _load_song_using_libsndfile(filename) || _load_song_using_libmpg123(filename);
-		if (ok && _channelCount > 1 && _config->mono()) {
-			float average = 0; // for mono option enabled and more then one channels
-			for (size_t i = 0, c = _left.size() ; i < c ; ++i) {
-				average = (_left[i] + _right[i]) / 2.f;
-				_left[i] = average;
-				_right[i] = average;
+		std::lock_guard<std::mutex> lk(_load_lock);
+		std::unique_ptr<Song> song;
+		MemorySong *mem = 0;
+
+		_stop_decoder();
+
+		if (_config && _config->stream()) {
+			// --mono is applied by the streamer as it decodes.
+			song.reset( _load_song_streaming(filename) );
+		} else {
+			_max_shift = INT_MAX;
+			if (_cache) {
+				song.reset( _cache->open(filename, _config->mono()) );
+				if (song) {
+					_message("Opened file from cache.");
+				}
+			}
+			if (!song && _config && _config->progressive()) {
+				std::promise<bool> ready;
+				std::future<bool> ok = ready.get_future();
+				std::string name(filename);
+				_decoder = std::thread([this, name](std::promise<bool> r) {
+					_load_song_into_memory(name.c_str(), &r);
+				}, std::move(ready));
+				return ok.get();
+			}
+			if (!song) {
+				mem = _load_song_into_memory(filename, 0);
+				song.reset( mem );
 			}
 		}
-		return ok;
+		if (!song) {
+			return false;
+		}
+
+		song.reset( _post_song(song.release()) );
+		if (song) {
+			return false;
+		}
+		if (mem && _cache) {
+			// The song stays alive until the next load, which
+			// stops this first.
+			std::string name(filename);
+			_loading = mem;
+			_decoder = std::thread([this, name, mem]() {
+				_store_in_cache(name.c_str(), mem);
+				_loading = 0;
+			});
+		}
+		return true;
+	}
+
+	bool Engine::set_shift(int p_shift)
+	{
+		if( std::abs(p_shift) > _max_shift ) {
+			return false;
+		}
+		_shift = p_shift;
+		return true;
 	}
 
 	void Engine::play()
@@ -505,7 +1806,7 @@ namespace StretchPlayer
 
 	float Engine::get_position()
 	{
-		if(_left.size() > 0) {
+		if(_song_length > 0) {
 			return float(_output_position) / _sample_rate;
 		}
 		return 0;
@@ -513,6 +1814,15 @@ namespace StretchPlayer
 
 	void Engine::loop_ab()
 	{
+		// The loop cache is allocated here, not in the audio
+		// thread.
+		if( !_loop_cache_allocated.load(std::memory_order_acquire) ) {
+			uint32_t frames = LOOP_CACHE_SECONDS * _audio_system->sample_rate();
+			_loop_cache_buf[0].reset( new float[frames] );
+			_loop_cache_buf[1].reset( new float[frames] );
+			_loop_cache_capacity = frames;
+			_loop_cache_allocated.store(true, std::memory_order_release);
+		}
 		_loop_ab_pressed.fetch_add(1, std::memory_order_relaxed);
 	}
 
@@ -522,7 +1832,7 @@ namespace StretchPlayer
 			uint32_t pos, lat;
 			uint32_t pressed_frame, seg_frame;
 
-			assert( _stretcher.time_ratio() > 0 );
+			assert( _stretcher->time_ratio() > 0 );
 			pos = _output_position;
 
 			if(pos > lat) pos -= lat;
@@ -550,8 +1860,8 @@ namespace StretchPlayer
 
 	float Engine::get_length()
 	{
-		if(_left.size() > 0) {
-			return float(_left.size()) / _sample_rate;
+		if(_song_length > 0) {
+			return float(_song_length) / _sample_rate;
 		}
 		return 0;
 	}
@@ -560,9 +1870,15 @@ namespace StretchPlayer
 	{
 		unsigned long pos = secs * _sample_rate;
 		std::lock_guard<std::mutex> lk(_audio_lock);
+		if( _playing && _song ) {
+			// Crossfade to it (see _start_seek())
+			_seek_target = pos;
+			_seek_requested = true;
+			return;
+		}
 		_output_position = _position = pos;
 		_state_changed = true;
-		_stretcher.reset();
+		_stretcher->reset();
 	}
 
 	void Engine::_dispatch_message(const Engine::callback_seq_t& seq, const char *msg) const
@@ -596,7 +1912,7 @@ namespace StretchPlayer
 
 		audio_load = _audio_system->dsp_load();
 		if(_playing) {
-			worker_load = _stretcher.cpu_load();
+			worker_load = _stretchers[0].cpu_load() + _stretchers[1].cpu_load();
 		} else {
 			worker_load = 0.0;
 		}
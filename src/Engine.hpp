@@ -24,6 +24,8 @@
 #include <thread>
 #include <mutex>
 #include <atomic>
+#include <future>
+#include <functional>
 #include <vector>
 #include <set>
 #include "RubberBandServer.hpp"
@@ -36,6 +38,9 @@ class Configuration;
 class EngineMessageCallback;
 class AudioSystem;
 class RubberBandServer;
+class Song;
+class MemorySong;
+class PcmCache;
 
 class Engine
 {
@@ -70,9 +75,14 @@ public:
 	int get_shift() {
 	return _shift;
 	}
-	void set_shift(int p_shift) {
-		_shift = p_shift;
-	}
+	/**
+	 * Set the right channel's lead over the left, in seconds.
+	 *
+	 * \return false (and leave the shift alone) if the song is
+	 * streamed from disk and its window can't cover the shift.
+	 * Reload the song to get a larger window.
+	 */
+	bool set_shift(int p_shift);
 	int get_pitch() {
 	return _pitch;
 	}
@@ -117,6 +127,16 @@ public:
 	void unsubscribe_messages(EngineMessageCallback* obj) {
 	_unsubscribe_list(_message_callbacks, obj);
 	}
+	/**
+	 * Called (from a non-RT thread) when playback has caught up
+	 * with a song that is still loading.  See --progressive.
+	 */
+	void subscribe_underruns(EngineMessageCallback* obj) {
+	_subscribe_list(_underrun_callbacks, obj);
+	}
+	void unsubscribe_underruns(EngineMessageCallback* obj) {
+	_unsubscribe_list(_underrun_callbacks, obj);
+	}
 
 private:
 	static int static_process_callback(uint32_t nframes, void* arg) {
@@ -133,8 +153,34 @@ private:
 
 	void _zero_buffers(uint32_t nframes);
 	void _process_playing(uint32_t nframes);
-	bool _load_song_using_libsndfile(const char *filename);
-	bool _load_song_using_libmpg123(const char *filename);
+	void _update_bypass(bool unity);
+	uint32_t _read_direct(float *&left, float *&right, uint32_t count);
+	void _bypass_mix(float *buf_L, float *buf_R, uint32_t nframes, int fade);
+	bool _pull_leaving(float *buf_L, float *buf_R, uint32_t nframes);
+	uint32_t _feed(RubberBandServer *stretcher, unsigned long& position);
+	uint32_t _wait_for_stretcher(uint32_t nframes);
+	void _drop(RubberBandServer *stretcher, uint32_t& count);
+	void _start_seek();
+	void _seek_direct(float *buf_L, float *buf_R, uint32_t nframes);
+	void _pull_standby(float *buf_L, float *buf_R, uint32_t nframes);
+	void _finish_seek();
+	void _loop_cache_record(const float *buf_L, const float *buf_R, uint32_t nframes,
+				bool pulled, uint32_t fed);
+	void _loop_cache_play(float *buf_L, float *buf_R, uint32_t nframes);
+	void _loop_cache_leave();
+	bool _loop_cache_key_changed();
+	unsigned long _loop_wrap(double pos);
+	void _swap_song();
+	bool _load_song_using_libsndfile(const char *filename, MemorySong *song, std::promise<bool> *ready);
+	bool _load_song_using_libmpg123(const char *filename, MemorySong *song, std::promise<bool> *ready);
+	Song* _load_song_streaming(const char *filename);
+	MemorySong* _load_song_into_memory(const char *filename, std::promise<bool> *ready);
+	void _store_in_cache(const char *filename, MemorySong *song);
+	void _post_progressive(MemorySong *song, unsigned long chunk, std::promise<bool> *ready);
+	void _finish_song(MemorySong *song, unsigned long frames, std::promise<bool> *ready);
+	std::function<void ()> _progressive_idle(std::promise<bool> *ready);
+	Song* _post_song(Song *song);
+	void _stop_decoder();
 	void _handle_loop_ab();
 
 	typedef std::set<EngineMessageCallback*> callback_seq_t;
@@ -154,29 +200,140 @@ private:
 	bool _hit_end;
 	bool _state_changed;
 	mutable std::mutex _audio_lock;
-	std::vector<float> _left; // input data: candidate to push into stretcher
-	std::vector<float> _right; // input data: candidate to push into stretcher
-	std::vector<float> _null;
-	int _channelCount; // 1 for mono, 2 for stereo
+
+	/* Song handoff.  load_song() builds a song without any locks
+	 * and posts it in _next_song.  The audio thread swaps it in
+	 * for _song (which only it may touch), and posts the previous
+	 * one in _old_song so that a non-RT thread can delete it.
+	 */
+	Song *_song;
+	std::atomic<Song*> _next_song;
+	std::atomic<Song*> _old_song;
+	std::atomic<unsigned long> _song_length; // in frames
+	std::vector<float> _feed_left;  // scratch for Song::read()
+	std::vector<float> _feed_right; // scratch for Song::read()
+	std::unique_ptr<PcmCache> _cache; // 0 if disabled
+
+	/* Progressive loading.  _decoder finishes decoding _loading
+	 * after it has been handed to the audio thread.  The audio
+	 * thread counts each time it runs dry (_starved).
+	 */
+	std::mutex _load_lock;
+	std::thread _decoder;
+	std::atomic<MemorySong*> _loading;
+	std::atomic<unsigned long> _underruns;
+	unsigned long _underruns_reported;
+	bool _starved;
+
 	unsigned long _position;
 	unsigned long _loop_a;
 	unsigned long _loop_b;
 	std::atomic<int> _loop_ab_pressed;
-	float _sample_rate;
+	std::atomic<float> _sample_rate;
 	float _stretch;
 	int _shift;
+	std::atomic<int> _max_shift; // largest |_shift| the song can serve
 	int _pitch;
 	float _gain;
 	//std::unique_ptr<RubberBandServer> _stretcher;
-	RubberBandServer _stretcher;
+	RubberBandServer _stretchers[2];
+	RubberBandServer *_stretcher; // the one being heard
+	RubberBandServer *_standby;   // pre-rolls seeks
 	std::unique_ptr<AudioSystem> _audio_system;
 
 	/* Latency tracking */
 	unsigned long _output_position;
 
+	/* Bypass.  At unity stretch and pitch, with matching sample
+	 * rates, the song is copied straight to the output and the
+	 * stretcher is left idle.  Switching between the two paths
+	 * crossfades over BYPASS_XFADE frames.
+	 *
+	 * ENTERING: stretcher out, direct in.  LEAVING: the stretcher
+	 * is primed _bypass_target (its latency) ahead of the direct
+	 * path, its first _discard frames are dropped, and then it
+	 * fades in once the direct path has reached _bypass_target.
+	 *
+	 * Both of those read the song at two places.  A song that
+	 * can't do that (_single_reader) switches straight between
+	 * OFF and ON instead.
+	 */
+	typedef enum {
+		BYPASS_OFF = 0,
+		BYPASS_ENTERING,
+		BYPASS_ON,
+		BYPASS_LEAVING
+	} bypass_t;
+	bypass_t _bypass;
+	bool _single_reader;          // !_song->random_access()
+	unsigned long _bypass_pos;    // direct read position
+	unsigned long _bypass_target;
+	uint32_t _discard;
+	uint32_t _xfade;              // frames of the crossfade done
+	std::vector<float> _xfade_curve;
+
+	/* Seeking while playing.  locate() posts _seek_target.  On the
+	 * stretcher path, _standby is reset and fed from there while
+	 * _stretcher keeps playing.  Once its pre-roll is dropped and
+	 * it has output, the two are crossfaded and swapped.  In
+	 * bypass, the old and new read positions are crossfaded.
+	 * Either fade is equal power over SEEK_XFADE frames.  A
+	 * _single_reader song just jumps.
+	 */
+	typedef enum {
+		SEEK_IDLE = 0,
+		SEEK_PRIMING,   // _standby is filling
+		SEEK_FADING,    // _stretcher out, _standby in
+		SEEK_DIRECT     // bypass: _seek_old_pos out, _bypass_pos in
+	} seek_t;
+	seek_t _seek;
+	bool _seek_requested;
+	unsigned long _seek_target;
+	unsigned long _seek_pos;      // _standby's feed position
+	unsigned long _seek_old_pos;  // SEEK_DIRECT
+	uint32_t _seek_discard;
+	uint32_t _seek_xfade;
+	std::vector<float> _seek_curve;
+
+	/* A/B loop cache.  Once a loop has played at steady settings,
+	 * one period of the stretcher's output is recorded, the seam
+	 * is crossfaded, and the recording is played instead.  The
+	 * stretchers sit idle until something changes.  Then the
+	 * cache keeps playing while _standby pre-rolls, as for a seek
+	 * (LEAVING).  A _single_reader song skips LEAVING.
+	 *
+	 * The buffers are allocated by loop_ab(), outside the audio
+	 * thread, and never change size after that.
+	 */
+	typedef enum {
+		LOOP_CACHE_IDLE = 0,
+		LOOP_CACHE_RECORDING,
+		LOOP_CACHE_PLAYING,
+		LOOP_CACHE_LEAVING
+	} loop_cache_t;
+	typedef struct {
+		float stretch;
+		int pitch;
+		int shift;
+		unsigned long loop_a;
+		unsigned long loop_b;
+	} loop_cache_key_t;
+	loop_cache_t _loop_cache;
+	loop_cache_key_t _loop_cache_key;
+	std::atomic<bool> _loop_cache_allocated;
+	std::unique_ptr<float[]> _loop_cache_buf[2];
+	uint32_t _loop_cache_capacity; // frames
+	uint32_t _loop_cache_period;   // frames of output per pass
+	uint32_t _loop_cache_fill;     // frames recorded
+	uint32_t _loop_cache_idx;      // frame being played
+	unsigned long _loop_cache_fed; // input frames at steady settings
+	double _loop_cache_in0;        // input position of frame 0
+	float _loop_cache_ratio;       // output frames per input frame
+
 	mutable std::mutex _callback_lock;
 	callback_seq_t _error_callbacks;
 	callback_seq_t _message_callbacks;
+	callback_seq_t _underrun_callbacks;
 
 }; // Engine
 
@@ -184,11 +341,12 @@ class EngineMessageCallback
 {
 public:
 	virtual ~EngineMessageCallback() {
-	if(_parent) {
-		_parent->unsubscribe_errors(this);
-	}
-	if(_parent) {
-		_parent->unsubscribe_messages(this);
+	// Each unsubscribe clears _parent
+	Engine *parent = _parent;
+	if(parent) {
+		parent->unsubscribe_errors(this);
+		parent->unsubscribe_messages(this);
+		parent->unsubscribe_underruns(this);
 	}
 	}
 
@@ -0,0 +1,96 @@
+/*
+ * Copyright(c) 2010 by Gabriel M. Beddingfield <gabriel@teuton.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY, without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "MappedSong.hpp"
+#include <sys/mman.h>
+
+namespace StretchPlayer
+{
+	MappedSong::MappedSong(void *map, size_t map_size,
+			       const float *left, const float *right,
+			       unsigned long frames, float sample_rate,
+			       int channels, bool mono) :
+		_map(map),
+		_map_size(map_size),
+		_left(left),
+		_right(right),
+		_frames(frames),
+		_sample_rate(sample_rate),
+		_channels(channels),
+		_mono(mono && (left != right))
+	{
+	}
+
+	MappedSong::~MappedSong()
+	{
+		munmap(_map, _map_size);
+	}
+
+	unsigned long MappedSong::frames() const
+	{
+		return _frames;
+	}
+
+	float MappedSong::sample_rate() const
+	{
+		return _sample_rate;
+	}
+
+	int MappedSong::channels() const
+	{
+		return _channels;
+	}
+
+	uint32_t MappedSong::read(unsigned long pos, long shift, float *&left, float *&right, uint32_t count)
+	{
+		if( pos >= _frames ) {
+			return 0;
+		}
+		if( pos + count > _frames ) {
+			count = _frames - pos;
+		}
+
+		if (_mono) {
+			// Mix both lanes down into the scratch buffers.
+			if (shift > 0) {
+				mix_lanes(left, _left, _right, _frames, pos, count);
+				mix_lanes(right, _left, _right, _frames, pos + shift, count);
+			} else {
+				mix_lanes(left, _left, _right, _frames, pos - shift, count);
+				mix_lanes(right, _left, _right, _frames, pos, count);
+			}
+			return count;
+		}
+
+		if (shift > 0) {
+			// actual position at the left channel
+			left = const_cast<float*>(&_left[pos]);
+			right = lane_at(right, _right, _frames, pos + shift, count);
+		} else if (shift < 0) {
+			// actual position at the right channel
+			left = lane_at(left, _left, _frames, pos - shift, count);
+			right = const_cast<float*>(&_right[pos]);
+		} else {
+			left = const_cast<float*>(&_left[pos]);
+			right = const_cast<float*>(&_right[pos]);
+		}
+		return count;
+	}
+
+} // namespace StretchPlayer
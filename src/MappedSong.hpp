@@ -0,0 +1,71 @@
+/*
+ * Copyright(c) 2010 by Gabriel M. Beddingfield <gabriel@teuton.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY, without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+#ifndef MAPPEDSONG_HPP
+#define MAPPEDSONG_HPP
+
+#include "Song.hpp"
+#include <stddef.h>
+
+namespace StretchPlayer
+{
+	/**
+	 * \brief A song played straight out of a memory-mapped file.
+	 *
+	 * The file holds planar float audio: one or two lanes of
+	 * frames() samples each.  With one lane, it's presented on
+	 * both channels.  See PcmCache.
+	 */
+	class MappedSong : public Song
+	{
+	public:
+	/**
+	 * Takes ownership of the mapping, which is unmapped in the
+	 * destructor.
+	 *
+	 * \param mono if true, two lanes are mixed down to mono as
+	 * they are read.
+	 */
+	MappedSong(void *map, size_t map_size,
+		   const float *left, const float *right,
+		   unsigned long frames, float sample_rate,
+		   int channels, bool mono);
+	MappedSong(const MappedSong&) = delete;
+	virtual ~MappedSong();
+
+	/* Implementing all of Song's interface:
+	 */
+	virtual unsigned long frames() const;
+	virtual float sample_rate() const;
+	virtual int channels() const;
+	virtual uint32_t read(unsigned long pos, long shift, float *&left, float *&right, uint32_t count);
+
+	private:
+	void *_map;
+	size_t _map_size;
+	const float *_left;
+	const float *_right; // same as _left for mono
+	unsigned long _frames;
+	float _sample_rate;
+	int _channels;
+	bool _mono;
+	};
+
+} // namespace StretchPlayer
+
+#endif // MAPPEDSONG_HPP
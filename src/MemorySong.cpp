@@ -0,0 +1,240 @@
+/*
+ * Copyright(c) 2010 by Gabriel M. Beddingfield <gabriel@teuton.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY, without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "MemorySong.hpp"
+#include "bams_deinterleave.h"
+#include "bams_pack.h"
+#include <cstring>
+
+namespace StretchPlayer
+{
+	MemorySong::MemorySong(storage_t storage) :
+		_storage(storage),
+		_frames(0),
+		_sample_rate(48000.0),
+		_channels(0),
+		_mono(false),
+		_range_size(0),
+		_complete(true),
+		_cancelled(false)
+	{
+	}
+
+	MemorySong::~MemorySong()
+	{
+	}
+
+	unsigned long MemorySong::frames() const
+	{
+		return _frames;
+	}
+
+	float MemorySong::sample_rate() const
+	{
+		return _sample_rate;
+	}
+
+	int MemorySong::channels() const
+	{
+		return _channels;
+	}
+
+	void MemorySong::set_format(float sample_rate, int channels)
+	{
+		_sample_rate = sample_rate;
+		_channels = channels;
+	}
+
+	void MemorySong::resize(unsigned long frames)
+	{
+		int lane, lanes = (_channels > 1) ? 2 : 1;
+
+		_frames = frames;
+		for (lane = 0 ; lane < lanes ; ++lane) {
+			if (_storage == FloatStorage) {
+				_lanes[lane].resize(frames);
+			} else {
+				_packed[lane].resize(frames);
+			}
+		}
+	}
+
+	float* MemorySong::write_buffer(int lane, unsigned long pos, float *scratch)
+	{
+		if (_storage == FloatStorage) {
+			return &_lanes[lane][pos];
+		}
+		return scratch;
+	}
+
+	void MemorySong::commit(int lane, unsigned long pos, const float *buf, uint32_t count)
+	{
+		switch (_storage) {
+		case Int16Storage:
+			bams_pack_s16((int16_t*)&_packed[lane][pos], buf, count);
+			break;
+		case HalfStorage:
+			bams_pack_f16(&_packed[lane][pos], buf, count);
+			break;
+		default:
+			break; // already in place
+		}
+	}
+
+	void MemorySong::get(int lane, unsigned long pos, float *dst, uint32_t count) const
+	{
+		uint32_t avail = 0;
+
+		if (pos < _frames) {
+			avail = (_frames - pos < count) ? (_frames - pos) : count;
+			switch (_storage) {
+			case Int16Storage:
+				bams_deinterleave_s16(&dst, 1, (const int16_t*)&_packed[lane][pos], 1, avail);
+				break;
+			case HalfStorage:
+				bams_unpack_f16(dst, &_packed[lane][pos], avail);
+				break;
+			default:
+				memcpy(dst, &_lanes[lane][pos], avail * sizeof(float));
+			}
+		}
+		memset(dst + avail, 0, (count - avail) * sizeof(float));
+	}
+
+	/**
+	 * Mix count frames, starting at pos, down to mono.
+	 */
+	void MemorySong::_mix(float *dst, unsigned long pos, uint32_t count) const
+	{
+		if (_storage == FloatStorage) {
+			mix_lanes(dst, &_lanes[0][0], &_lanes[1][0], _frames, pos, count);
+			return;
+		}
+
+		float right[256];
+		uint32_t n, k;
+		while (count) {
+			n = (count < 256) ? count : 256;
+			get(0, pos, dst, n);
+			get(1, pos, right, n);
+			for (k = 0 ; k < n ; ++k) {
+				dst[k] = (dst[k] + right[k]) / 2.f;
+			}
+			dst += n;
+			pos += n;
+			count -= n;
+		}
+	}
+
+	void MemorySong::set_ranges(unsigned long range_size)
+	{
+		unsigned long k, n = (_frames + range_size - 1) / range_size;
+
+		_range_size = range_size;
+		_filled.reset( new std::atomic<unsigned long>[n] );
+		for (k = 0 ; k < n ; ++k) {
+			_filled[k].store(k * range_size);
+		}
+		_complete = false;
+	}
+
+	void MemorySong::set_filled(unsigned long range_start, unsigned long end)
+	{
+		if (_filled) {
+			_filled[range_start / _range_size].store(end, std::memory_order_release);
+		}
+	}
+
+	void MemorySong::set_complete()
+	{
+		_complete.store(true, std::memory_order_release);
+	}
+
+	/**
+	 * How much of [pos, pos+count) has been decoded, counting
+	 * from pos.
+	 */
+	uint32_t MemorySong::_available(unsigned long pos, uint32_t count) const
+	{
+		unsigned long end = pos, filled;
+
+		if (_complete.load(std::memory_order_acquire)) {
+			return count;
+		}
+		while (end < pos + count) {
+			filled = _filled[end / _range_size].load(std::memory_order_acquire);
+			if (filled <= end) {
+				break;
+			}
+			end = filled;
+			if (end % _range_size) {
+				// Still decoding this range
+				break;
+			}
+		}
+		return (end - pos < count) ? (end - pos) : count;
+	}
+
+	uint32_t MemorySong::read(unsigned long pos, long shift, float *&left, float *&right, uint32_t count)
+	{
+		if( pos >= _frames ) {
+			return 0;
+		}
+		if( pos + count > _frames ) {
+			count = _frames - pos;
+		}
+
+		// Both channels' audio must be decoded.
+		unsigned long ahead = pos + ((shift > 0) ? shift : -shift);
+		count = _available(pos, count);
+		if (ahead != pos && ahead < _frames) {
+			uint32_t n = count;
+			if (ahead + n > _frames) {
+				n = _frames - ahead;
+			}
+			uint32_t got = _available(ahead, n);
+			if (got < n) {
+				count = got;
+			}
+		}
+		if (count == 0) {
+			return 0;
+		}
+
+		// shift > 0: actual position at the left channel
+		// shift < 0: actual position at the right channel
+		unsigned long pos_l = (shift < 0) ? pos - shift : pos;
+		unsigned long pos_r = (shift > 0) ? pos + shift : pos;
+		int lane_r = (_channels > 1) ? 1 : 0;
+
+		if (_mono && _channels > 1) {
+			// Mix both channels down into the scratch buffers.
+			_mix(left, pos_l, count);
+			_mix(right, pos_r, count);
+		} else if (_storage == FloatStorage) {
+			left = lane_at(left, &_lanes[0][0], _frames, pos_l, count);
+			right = lane_at(right, &_lanes[lane_r][0], _frames, pos_r, count);
+		} else {
+			get(0, pos_l, left, count);
+			get(lane_r, pos_r, right, count);
+		}
+		return count;
+	}
+
+} // namespace StretchPlayer
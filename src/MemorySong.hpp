@@ -0,0 +1,112 @@
+/*
+ * Copyright(c) 2010 by Gabriel M. Beddingfield <gabriel@teuton.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY, without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+#ifndef MEMORYSONG_HPP
+#define MEMORYSONG_HPP
+
+#include "Song.hpp"
+#include <vector>
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+
+namespace StretchPlayer
+{
+	/**
+	 * \brief A song that is fully decoded into memory.
+	 *
+	 * Samples may be stored as float, or in 16 bits (signed
+	 * integer or half float) to halve the memory used.  16-bit
+	 * samples are widened to float a block at a time as they're
+	 * read.
+	 *
+	 * Mono files are stored once.  Lane 1 is only used for stereo.
+	 *
+	 * The song may be handed to the Engine while it is still being
+	 * decoded (see set_ranges()).  read() only delivers audio that
+	 * has already been decoded.
+	 */
+	class MemorySong : public Song
+	{
+	public:
+	typedef enum { FloatStorage = 0, Int16Storage = 1, HalfStorage = 2 } storage_t;
+
+	MemorySong(storage_t storage = FloatStorage);
+	virtual ~MemorySong();
+
+	/* Implementing all of Song's interface:
+	 */
+	virtual unsigned long frames() const;
+	virtual float sample_rate() const;
+	virtual int channels() const;
+	virtual uint32_t read(unsigned long pos, long shift, float *&left, float *&right, uint32_t count);
+
+	/* For the loaders.  Call set_format() first, then resize().
+	 * To store a block, decode it into the buffer given by
+	 * write_buffer(), then pass that to commit().  With float
+	 * storage, the buffer is the song's own storage.  Otherwise,
+	 * it's scratch (which must hold count floats), and commit()
+	 * converts.
+	 */
+	void set_format(float sample_rate, int channels);
+	void set_mono(bool mono) { _mono = mono; } // mix down as it's read
+	void resize(unsigned long frames);
+	float* write_buffer(int lane, unsigned long pos, float *scratch);
+	void commit(int lane, unsigned long pos, const float *buf, uint32_t count);
+
+	/**
+	 * Copy count frames of a lane, starting at pos, to dst as
+	 * float.  Frames past the end are silence.  [RT SAFE]
+	 */
+	void get(int lane, unsigned long pos, float *dst, uint32_t count) const;
+
+	/* Progressive loading.  The buffers are sized up front and
+	 * split into ranges of range_size frames.  Each range is
+	 * decoded from its start by one thread, which publishes its
+	 * progress with set_filled().  Until set_complete(), read()
+	 * delivers only the decoded part of each range.  The buffers
+	 * must not be resized after set_ranges().
+	 */
+	void set_ranges(unsigned long range_size);
+	void set_filled(unsigned long range_start, unsigned long end);
+	void set_complete();
+	void cancel() { _cancelled = true; }
+	bool cancelled() const { return _cancelled; }
+
+	private:
+	uint32_t _available(unsigned long pos, uint32_t count) const;
+
+	void _mix(float *dst, unsigned long pos, uint32_t count) const;
+
+	storage_t _storage;
+	unsigned long _frames;
+	std::vector<float> _lanes[2];    // for FloatStorage
+	std::vector<uint16_t> _packed[2]; // for 16-bit storage
+	float _sample_rate;
+	int _channels; // 1 for mono, 2 for stereo
+	bool _mono;
+
+	unsigned long _range_size;
+	std::unique_ptr< std::atomic<unsigned long>[] > _filled; // one per range
+	std::atomic<bool> _complete;
+	std::atomic<bool> _cancelled;
+	};
+
+} // namespace StretchPlayer
+
+#endif // MEMORYSONG_HPP
@@ -0,0 +1,202 @@
+/*
+ * Copyright(c) 2010 by Gabriel M. Beddingfield <gabriel@teuton.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY, without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "Mpg123.hpp"
+#include "bams_deinterleave.h"
+#include <mpg123.h>
+#include <mutex>
+#include <cstdlib>
+#include <stdint.h>
+
+namespace StretchPlayer
+{
+namespace Mpg123
+{
+	static std::once_flag init_once;
+	static int init_result = MPG123_OK;
+
+	static void exit_library()
+	{
+		mpg123_exit();
+	}
+
+	int init()
+	{
+		std::call_once(init_once, []() {
+				init_result = mpg123_init();
+				if( init_result == MPG123_OK )
+					atexit(exit_library);
+			});
+		return init_result;
+	}
+
+	void request_float(mpg123_handle *mh)
+	{
+		const long *rates;
+		size_t k, count;
+		int err = MPG123_OK;
+
+		mpg123_rates(&rates, &count);
+		mpg123_format_none(mh);
+		for( k=0 ; k<count && err == MPG123_OK ; ++k ) {
+			err = mpg123_format(mh, rates[k], MPG123_MONO | MPG123_STEREO,
+					    MPG123_ENC_FLOAT_32);
+		}
+		if( err != MPG123_OK )
+			mpg123_format_all(mh);
+	}
+
+	void lock_format(mpg123_handle *mh, long rate, int channels, int encoding)
+	{
+		mpg123_format_none(mh);
+		mpg123_format(mh, rate, channels, encoding);
+	}
+
+	size_t frame_bytes(int encoding, int channels)
+	{
+		return mpg123_encsize(encoding) * channels;
+	}
+
+	/* G.711 decoders, scaled to 16 bits */
+	static int ulaw_to_s16(uint8_t u)
+	{
+		int t;
+		u = ~u;
+		t = ((u & 0x0F) << 3) + 0x84;
+		t <<= (u & 0x70) >> 4;
+		return (u & 0x80) ? (0x84 - t) : (t - 0x84);
+	}
+
+	static int alaw_to_s16(uint8_t a)
+	{
+		int t, seg;
+		a ^= 0x55;
+		t = (a & 0x0F) << 4;
+		seg = (a & 0x70) >> 4;
+		if( seg == 0 ) {
+			t += 8;
+		} else {
+			t += 0x108;
+			if( seg > 1 )
+				t <<= seg - 1;
+		}
+		return (a & 0x80) ? t : -t;
+	}
+
+	/* Packed 24-bit samples are in native byte order */
+	static int32_t read_s24(const uint8_t *p)
+	{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		return int32_t( (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) ) >> 8;
+#else
+		return int32_t( (uint32_t(p[2]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[0]) << 8) ) >> 8;
+#endif
+	}
+
+	/**
+	 * Convert interleaved samples of any mpg123 encoding to float.
+	 */
+	static void to_float(float *dst, const void *src, int encoding, size_t samples)
+	{
+		size_t k;
+		const uint8_t *b = static_cast<const uint8_t*>(src);
+
+		switch(encoding) {
+		case MPG123_ENC_SIGNED_8:
+			for( k=0 ; k<samples ; ++k )
+				dst[k] = int8_t(b[k]) / 128.0f;
+			break;
+		case MPG123_ENC_UNSIGNED_8:
+			for( k=0 ; k<samples ; ++k )
+				dst[k] = (int(b[k]) - 128) / 128.0f;
+			break;
+		case MPG123_ENC_ULAW_8:
+			for( k=0 ; k<samples ; ++k )
+				dst[k] = ulaw_to_s16(b[k]) / 32768.0f;
+			break;
+		case MPG123_ENC_ALAW_8:
+			for( k=0 ; k<samples ; ++k )
+				dst[k] = alaw_to_s16(b[k]) / 32768.0f;
+			break;
+		case MPG123_ENC_SIGNED_16: {
+			const int16_t *s = static_cast<const int16_t*>(src);
+			for( k=0 ; k<samples ; ++k )
+				dst[k] = s[k] / 32768.0f;
+		}	break;
+		case MPG123_ENC_UNSIGNED_16: {
+			const uint16_t *s = static_cast<const uint16_t*>(src);
+			for( k=0 ; k<samples ; ++k )
+				dst[k] = (int(s[k]) - 32768) / 32768.0f;
+		}	break;
+		case MPG123_ENC_SIGNED_24:
+			for( k=0 ; k<samples ; ++k )
+				dst[k] = read_s24(&b[3*k]) / 8388608.0f;
+			break;
+		case MPG123_ENC_UNSIGNED_24:
+			for( k=0 ; k<samples ; ++k )
+				dst[k] = (read_s24(&b[3*k]) ^ int32_t(0xFF800000)) / 8388608.0f;
+			break;
+		case MPG123_ENC_SIGNED_32: {
+			const int32_t *s = static_cast<const int32_t*>(src);
+			for( k=0 ; k<samples ; ++k )
+				dst[k] = s[k] / 2147483648.0f;
+		}	break;
+		case MPG123_ENC_UNSIGNED_32: {
+			const uint32_t *s = static_cast<const uint32_t*>(src);
+			for( k=0 ; k<samples ; ++k )
+				dst[k] = int32_t(s[k] ^ 0x80000000u) / 2147483648.0f;
+		}	break;
+		case MPG123_ENC_FLOAT_32: {
+			const float *s = static_cast<const float*>(src);
+			for( k=0 ; k<samples ; ++k )
+				dst[k] = s[k];
+		}	break;
+		case MPG123_ENC_FLOAT_64: {
+			const double *s = static_cast<const double*>(src);
+			for( k=0 ; k<samples ; ++k )
+				dst[k] = float(s[k]);
+		}	break;
+		default:
+			for( k=0 ; k<samples ; ++k )
+				dst[k] = 0.0f;
+		}
+	}
+
+	void deinterleave(float *planar[], int nplanar, const void *src, int encoding,
+			  int channels, unsigned long frames, std::vector<float>& scratch)
+	{
+		switch(encoding) {
+		case MPG123_ENC_FLOAT_32:
+			bams_deinterleave_float(planar, nplanar,
+						static_cast<const float*>(src), channels, frames);
+			break;
+		case MPG123_ENC_SIGNED_16:
+			bams_deinterleave_s16(planar, nplanar,
+					      static_cast<const int16_t*>(src), channels, frames);
+			break;
+		default:
+			if( scratch.size() < frames * channels )
+				scratch.resize(frames * channels);
+			to_float(&scratch[0], src, encoding, frames * channels);
+			bams_deinterleave_float(planar, nplanar, &scratch[0], channels, frames);
+		}
+	}
+
+} // namespace Mpg123
+} // namespace StretchPlayer
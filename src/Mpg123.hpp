@@ -0,0 +1,76 @@
+/*
+ * Copyright(c) 2010 by Gabriel M. Beddingfield <gabriel@teuton.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY, without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+#ifndef MPG123_HPP
+#define MPG123_HPP
+
+#include <stddef.h>
+#include <vector>
+
+struct mpg123_handle_struct;
+
+namespace StretchPlayer
+{
+	/**
+	 * \brief Helpers shared by everything that decodes with
+	 * libmpg123.
+	 */
+	namespace Mpg123
+	{
+	/**
+	 * Initialize the library.  Only the first call does any work;
+	 * mpg123_exit() is called when the process exits.
+	 *
+	 * \return MPG123_OK, or the error from mpg123_init().
+	 */
+	int init();
+
+	/**
+	 * Ask the decoder for 32-bit float output at every rate.  If
+	 * the library can't do float, any encoding is allowed.
+	 * Call before mpg123_open().
+	 */
+	void request_float(mpg123_handle_struct *mh);
+
+	/**
+	 * Lock the decoder to one output format, e.g. for a second
+	 * handle on the same file.  Call before mpg123_open().
+	 */
+	void lock_format(mpg123_handle_struct *mh, long rate, int channels, int encoding);
+
+	/**
+	 * Bytes per frame of decoder output.  Allocate decode buffers
+	 * as double so that they are aligned for any encoding.
+	 */
+	size_t frame_bytes(int encoding, int channels);
+
+	/**
+	 * Split interleaved decoder output into up to two float
+	 * channels.
+	 *
+	 * Float and 16-bit output go straight to the deinterleaver.
+	 * Anything else is converted to float in scratch first.
+	 */
+	void deinterleave(float *planar[], int nplanar, const void *src, int encoding,
+			  int channels, unsigned long frames, std::vector<float>& scratch);
+
+	} // namespace Mpg123
+
+} // namespace StretchPlayer
+
+#endif // MPG123_HPP
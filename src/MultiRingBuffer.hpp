@@ -0,0 +1,241 @@
+/*
+ * Copyright(c) 2010 by Gabriel M. Beddingfield <gabriel@teuton.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY, without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+#ifndef MULTIRINGBUFFER_HPP
+#define MULTIRINGBUFFER_HPP
+
+#include <atomic>
+#include <cstring>
+#include <cstdlib>
+#include <new>
+
+namespace StretchPlayer
+{
+	/**
+	 * \brief Single-producer/single-consumer ring buffer with N
+	 * planar lanes of Capacity frames.
+	 *
+	 * All lanes share one read index and one write index, so a
+	 * stereo write or read costs one pair of atomic operations
+	 * and the lanes can never get out of step.
+	 *
+	 * Capacity must be a power of 2.  The indices run freely and
+	 * are masked on use, so the whole buffer is usable.
+	 *
+	 * The write index and the read index live on separate cache
+	 * lines, each next to the owning side's cached copy of the
+	 * other index.  read() and write() only reload the other
+	 * side's index when the cached one says there isn't enough.
+	 * Each lane starts on a cache line, too.
+	 *
+	 * Producer only: write(), write_space(), get_write_vector(),
+	 * increment_write_idx(), write_idx().  Consumer only: read(),
+	 * get_read_vector(), increment_read_idx(), discard(),
+	 * discard_to().  read_space() is safe from either side.
+	 */
+	template<class T, unsigned N, unsigned Capacity>
+	class MultiRingBuffer
+	{
+	public:
+	static const unsigned CACHE_LINE = 64;
+
+	struct rw_vector {
+		T *buf[N][2];   // buf[lane][part]
+		unsigned len[2];
+	};
+
+	MultiRingBuffer() {
+		void *mem;
+		static_assert( Capacity && !(Capacity & (Capacity - 1)),
+			       "Capacity must be a power of 2" );
+		static_assert( sizeof(side_t) <= CACHE_LINE, "side_t must fit a cache line" );
+
+		if (posix_memalign(&mem, CACHE_LINE, 2 * CACHE_LINE + LANE_BYTES * N) != 0)
+			throw std::bad_alloc();
+		_mem = static_cast<char*>(mem);
+		_producer = new (_mem) side_t;
+		_consumer = new (_mem + CACHE_LINE) side_t;
+		_buf = reinterpret_cast<T*>(_mem + 2 * CACHE_LINE);
+		reset();
+	}
+	MultiRingBuffer(const MultiRingBuffer&) = delete;
+
+	~MultiRingBuffer() {
+		_producer->~side_t();
+		_consumer->~side_t();
+		free(_mem);
+	}
+
+	void reset() {
+		/* !!! NOT THREAD SAFE !!! */
+		_producer->idx.store(0, std::memory_order_relaxed);
+		_producer->cached = 0;
+		_consumer->idx.store(0, std::memory_order_relaxed);
+		_consumer->cached = 0;
+	}
+
+	unsigned read_space() const {
+		unsigned r = _consumer->idx.load(std::memory_order_acquire);
+		return _producer->idx.load(std::memory_order_acquire) - r;
+	}
+
+	unsigned write_space() {
+		_producer->cached = _consumer->idx.load(std::memory_order_acquire);
+		return Capacity - (_producer->idx.load(std::memory_order_relaxed) - _producer->cached);
+	}
+
+	/**
+	 * Copy up to cnt frames out of every lane.
+	 * \return frames read
+	 */
+	unsigned read(T * const *dest, unsigned cnt) {
+		unsigned r = _consumer->idx.load(std::memory_order_relaxed);
+		if (_consumer->cached - r < cnt)
+			_consumer->cached = _producer->idx.load(std::memory_order_acquire);
+		if (cnt > _consumer->cached - r)
+			cnt = _consumer->cached - r;
+		_copy_out(dest, r & MASK, cnt);
+		_consumer->idx.store(r + cnt, std::memory_order_release);
+		return cnt;
+	}
+
+	/**
+	 * Copy up to cnt frames into every lane.
+	 * \return frames written
+	 */
+	unsigned write(const T * const *src, unsigned cnt) {
+		unsigned w = _producer->idx.load(std::memory_order_relaxed);
+		if (Capacity - (w - _producer->cached) < cnt)
+			_producer->cached = _consumer->idx.load(std::memory_order_acquire);
+		if (cnt > Capacity - (w - _producer->cached))
+			cnt = Capacity - (w - _producer->cached);
+		_copy_in(src, w & MASK, cnt);
+		_producer->idx.store(w + cnt, std::memory_order_release);
+		return cnt;
+	}
+
+	/**
+	 * The readable frames, in place.  Two parts when they wrap.
+	 */
+	void get_read_vector(rw_vector *vec) {
+		unsigned r = _consumer->idx.load(std::memory_order_relaxed);
+		_consumer->cached = _producer->idx.load(std::memory_order_acquire);
+		_vector(vec, r & MASK, _consumer->cached - r);
+	}
+
+	/**
+	 * The writable frames, in place.  Two parts when they wrap.
+	 */
+	void get_write_vector(rw_vector *vec) {
+		unsigned w = _producer->idx.load(std::memory_order_relaxed);
+		_producer->cached = _consumer->idx.load(std::memory_order_acquire);
+		_vector(vec, w & MASK, Capacity - (w - _producer->cached));
+	}
+
+	void increment_read_idx(unsigned cnt) {
+		_consumer->idx.store(_consumer->idx.load(std::memory_order_relaxed) + cnt,
+				     std::memory_order_release);
+	}
+
+	void increment_write_idx(unsigned cnt) {
+		_producer->idx.store(_producer->idx.load(std::memory_order_relaxed) + cnt,
+				     std::memory_order_release);
+	}
+
+	/**
+	 * Drop what was written before the write index was w (see
+	 * write_idx()).  Unlike reset(), only the read index moves, so
+	 * the producer may keep writing meanwhile.
+	 */
+	void discard_to(unsigned w) {
+		unsigned r = _consumer->idx.load(std::memory_order_relaxed);
+		if (int(w - r) > 0)
+			_consumer->idx.store(w, std::memory_order_release);
+		_consumer->cached = _producer->idx.load(std::memory_order_acquire);
+	}
+
+	/**
+	 * Drop everything that is readable now.
+	 */
+	void discard() {
+		discard_to(_producer->idx.load(std::memory_order_acquire));
+	}
+
+	unsigned write_idx() const {
+		return _producer->idx.load(std::memory_order_relaxed);
+	}
+
+	unsigned bufsize() const { return Capacity; }
+	unsigned lanes() const { return N; }
+
+	private:
+	static const unsigned MASK = Capacity - 1;
+	static const unsigned LANE_BYTES =
+		(Capacity * sizeof(T) + CACHE_LINE - 1) & ~(CACHE_LINE - 1);
+
+	/* One side's index, and its copy of the other side's. */
+	struct side_t {
+		std::atomic<unsigned> idx;
+		unsigned cached;
+	};
+
+	T* _lane(unsigned k) const {
+		return reinterpret_cast<T*>(reinterpret_cast<char*>(_buf) + k * LANE_BYTES);
+	}
+
+	void _vector(rw_vector *vec, unsigned idx, unsigned cnt) const {
+		unsigned n1 = (idx + cnt > Capacity) ? (Capacity - idx) : cnt;
+		unsigned k;
+		for (k = 0 ; k < N ; ++k) {
+			vec->buf[k][0] = _lane(k) + idx;
+			vec->buf[k][1] = _lane(k);
+		}
+		vec->len[0] = n1;
+		vec->len[1] = cnt - n1;
+	}
+
+	void _copy_out(T * const *dest, unsigned idx, unsigned cnt) const {
+		unsigned n1 = (idx + cnt > Capacity) ? (Capacity - idx) : cnt;
+		unsigned k;
+		for (k = 0 ; k < N ; ++k) {
+			memcpy(dest[k], _lane(k) + idx, n1 * sizeof(T));
+			if (cnt > n1)
+				memcpy(dest[k] + n1, _lane(k), (cnt - n1) * sizeof(T));
+		}
+	}
+
+	void _copy_in(const T * const *src, unsigned idx, unsigned cnt) {
+		unsigned n1 = (idx + cnt > Capacity) ? (Capacity - idx) : cnt;
+		unsigned k;
+		for (k = 0 ; k < N ; ++k) {
+			memcpy(_lane(k) + idx, src[k], n1 * sizeof(T));
+			if (cnt > n1)
+				memcpy(_lane(k), src[k] + n1, (cnt - n1) * sizeof(T));
+		}
+	}
+
+	private:
+	char *_mem;          // cache line aligned
+	side_t *_producer;   // first cache line
+	side_t *_consumer;   // second cache line
+	T *_buf;             // N lanes of LANE_BYTES
+	};
+
+} // namespace StretchPlayer
+
+#endif // MULTIRINGBUFFER_HPP
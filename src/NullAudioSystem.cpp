@@ -0,0 +1,283 @@
+/*
+ * Copyright(c) 2010 by Gabriel M. Beddingfield <gabriel@teuton.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY, without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "NullAudioSystem.hpp"
+#include "Configuration.hpp"
+#include <sndfile.h>
+#include <cassert>
+#include <cstring>
+#include <ctime>
+
+#include <iostream>
+
+namespace StretchPlayer
+{
+	static double elapsed(const timespec& a, const timespec& b)
+	{
+	return (b.tv_sec - a.tv_sec) + (b.tv_nsec - a.tv_nsec) / 1e9;
+	}
+
+	static void advance(timespec& t, double secs)
+	{
+	long ns = t.tv_nsec + long(secs * 1e9);
+	t.tv_sec += ns / 1000000000L;
+	t.tv_nsec = ns % 1000000000L;
+	}
+
+	NullAudioSystem::NullAudioSystem() :
+	_sample_rate(44100),
+	_period_nframes(1024),
+	_realtime(true),
+	_idle(false),
+	_active(false),
+	_sf(0),
+	_raw(0),
+	_callback(0),
+	_callback_arg(0),
+	_frame_time(0),
+	_segment_start(0),
+	_dsp_load(0.0f)
+	{
+	}
+
+	NullAudioSystem::~NullAudioSystem()
+	{
+	cleanup();
+	}
+
+	int NullAudioSystem::init(const char * /*app_name*/, Configuration *config, char *err_msg)
+	{
+	const char *out;
+
+	if(config == 0) {
+		if (err_msg)
+			strcat(err_msg, "The NullAudioSystem::init() function must have a non-null config parameter.");
+		goto init_bail;
+	}
+
+	_sample_rate = config->sample_rate();
+	_period_nframes = config->period_size();
+	_realtime = !config->free_run();
+
+	_left.resize(_period_nframes);
+	_right.resize(_period_nframes);
+	_interleaved.resize(2 * _period_nframes);
+
+	out = config->null_output();
+	if(out) {
+		size_t len = strlen(out);
+		if(len > 4 && strcasecmp(out + len - 4, ".wav") == 0) {
+			SF_INFO info;
+			memset(&info, 0, sizeof(info));
+			info.samplerate = _sample_rate;
+			info.channels = 2;
+			info.format = SF_FORMAT_WAV | SF_FORMAT_FLOAT;
+			_sf = sf_open(out, SFM_WRITE, &info);
+		} else if(strcmp(out, "-") == 0) {
+			if (err_msg)
+				strcat(err_msg, "cannot write the output to stdout, which carries the replies to commands");
+			goto init_bail;
+		} else {
+			_raw = fopen(out, "wb");
+		}
+		if(!_sf && !_raw) {
+			if (err_msg) {
+				strcat(err_msg, "cannot open output file '");
+				strcat(err_msg, out);
+				strcat(err_msg, "'");
+			}
+			goto init_bail;
+		}
+	}
+
+	return 0;
+
+	init_bail:
+	cleanup();
+	return 0xDEADBEEF;
+	}
+
+	void NullAudioSystem::cleanup()
+	{
+	deactivate();
+	if(_sf) {
+		sf_close(_sf);
+		_sf = 0;
+	}
+	if(_raw) {
+		fclose(_raw);
+		_raw = 0;
+	}
+	}
+
+	int NullAudioSystem::set_process_callback(process_callback_t cb, void* arg, char* /*err_msg*/)
+	{
+	assert(cb);
+	_callback = cb;
+	_callback_arg = arg;
+	return 0;
+	}
+
+	int NullAudioSystem::set_segment_size_callback(segment_size_callback_t, void*, char*)
+	{
+	// The period never changes
+	return 0;
+	}
+
+	int NullAudioSystem::activate(char * /*err_msg*/)
+	{
+	assert(!_active);
+	assert(!_left.empty());
+
+	_frame_time = 0;
+	_segment_start = 0;
+	_active = true;
+	_thread = std::thread(&NullAudioSystem::_run, this);
+	return 0;
+	}
+
+	int NullAudioSystem::deactivate(char * /*err_msg*/)
+	{
+	_active = false;
+	if(_thread.joinable())
+		_thread.join();
+	return 0;
+	}
+
+	AudioSystem::sample_t* NullAudioSystem::output_buffer(int index)
+	{
+	if(index == 0) {
+		return &_left[0];
+	} else if(index == 1) {
+		return &_right[0];
+	}
+	return 0;
+	}
+
+	uint32_t NullAudioSystem::output_buffer_size(int /*index*/)
+	{
+	return _period_nframes;
+	}
+
+	uint32_t NullAudioSystem::sample_rate()
+	{
+	return _sample_rate;
+	}
+
+	float NullAudioSystem::dsp_load()
+	{
+	return _dsp_load;
+	}
+
+	uint32_t NullAudioSystem::time_stamp()
+	{
+	return _frame_time;
+	}
+
+	uint32_t NullAudioSystem::segment_start_time_stamp()
+	{
+	return _segment_start;
+	}
+
+	uint32_t NullAudioSystem::current_segment_size()
+	{
+	return _period_nframes;
+	}
+
+	bool NullAudioSystem::free_running()
+	{
+	return !_realtime;
+	}
+
+	void NullAudioSystem::set_idle(bool idle)
+	{
+	_idle = idle;
+	}
+
+	/**
+	 * The clock thread.
+	 *
+	 * When paced, each period is due one period after the last.
+	 * If a callback runs so late that the next one is already
+	 * overdue, the clock starts over from now (like an xrun)
+	 * rather than trying to catch up.
+	 *
+	 * A free-running clock is paced too while the engine is idle,
+	 * and those (silent) periods aren't written.
+	 */
+	void NullAudioSystem::_run()
+	{
+	const double period = double(_period_nframes) / _sample_rate;
+	timespec next, a, b;
+	float load;
+	bool paced;
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	while(_active) {
+		assert(_callback);
+
+		paced = _realtime || _idle;
+		if(paced) {
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, 0);
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &a);
+		_segment_start = _frame_time.load();
+		if( _callback(_period_nframes, _callback_arg) != 0 ) {
+		std::cerr << "ERROR: Application's audio callback failed." << std::endl;
+		break;
+		}
+		if( !(_idle && !_realtime) && !_write(_period_nframes) ) {
+		std::cerr << "ERROR: Write to output file failed." << std::endl;
+		break;
+		}
+		_frame_time += _period_nframes;
+		clock_gettime(CLOCK_MONOTONIC, &b);
+
+		// Fraction of the period spent working, smoothed.
+		load = elapsed(a, b) / period;
+		if(load > 1.0f) load = 1.0f;
+		_dsp_load = 0.9f * _dsp_load + 0.1f * load;
+
+		// Free-running, the next period is due now.
+		advance(next, period);
+		if(!paced || elapsed(next, b) > period) {
+		next = b;
+		}
+	}
+	_active = false;
+	}
+
+	bool NullAudioSystem::_write(uint32_t nframes)
+	{
+	if(!_sf && !_raw) {
+		return true;
+	}
+	float *out = &_interleaved[0];
+	for(uint32_t k = 0 ; k < nframes ; ++k) {
+		out[2*k] = _left[k];
+		out[2*k + 1] = _right[k];
+	}
+	if(_sf) {
+		return sf_writef_float(_sf, out, nframes) == sf_count_t(nframes);
+	}
+	return fwrite(out, 2 * sizeof(float), nframes, _raw) == nframes;
+	}
+
+} // namespace StretchPlayer
@@ -0,0 +1,108 @@
+/*
+ * Copyright(c) 2010 by Gabriel M. Beddingfield <gabriel@teuton.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY, without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+#ifndef NULLAUDIOSYSTEM_HPP
+#define NULLAUDIOSYSTEM_HPP
+
+#include <AudioSystem.hpp>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <cstdio>
+
+struct SNDFILE_tag;
+
+namespace StretchPlayer
+{
+	class Configuration;
+
+	/**
+	 * \brief Audio driver without an audio device.
+	 *
+	 * A clock thread calls the process callback every period,
+	 * either paced like a sound card (realtime) or as fast as
+	 * possible (free-running).  The output is thrown away, or
+	 * written to a file: WAV if the name ends in ".wav",
+	 * otherwise raw interleaved native floats.  Not stdout, since
+	 * that carries the replies to commands.
+	 *
+	 * This is for hosts without a sound card, and for repeatable
+	 * measurements of the whole callback path.
+	 *
+	 * Free-running, the engine waits each period for the stretcher
+	 * to catch up, so the output is the song as it would play with
+	 * no xruns, and the same from run to run.  Only the speed of
+	 * the run depends on the machine.  While the engine is idle,
+	 * the clock is paced as in realtime and nothing is written, so
+	 * the output only has the periods that were played.
+	 */
+	class NullAudioSystem : public AudioSystem
+	{
+	public:
+	NullAudioSystem();
+	virtual ~NullAudioSystem();
+
+	/* Implementing all of AudioSystem's interface:
+	 */
+	virtual int init(const char *app_name, Configuration *config, char *err_msg = 0);
+	virtual void cleanup();
+	virtual int set_process_callback(process_callback_t cb, void* arg, char* err_msg = 0);
+	virtual int set_segment_size_callback(segment_size_callback_t cb, void* arg, char* err_msg = 0);
+	virtual int activate(char *err_msg = 0);
+	virtual int deactivate(char *err_msg = 0);
+	virtual sample_t* output_buffer(int index);
+	virtual uint32_t output_buffer_size(int index);
+	virtual uint32_t sample_rate();
+	virtual float dsp_load();
+	virtual uint32_t time_stamp();
+	virtual uint32_t segment_start_time_stamp();
+	virtual uint32_t current_segment_size();
+	virtual bool free_running();
+	virtual void set_idle(bool idle);
+
+	private:
+	void _run();
+	bool _write(uint32_t nframes);
+
+	private:
+	// Configuration variables:
+	uint32_t _sample_rate;
+	uint32_t _period_nframes;
+	bool _realtime;
+	bool _idle; // set by the callback, on the clock thread
+
+	std::thread _thread;
+	std::atomic<bool> _active;
+	std::vector<float> _left, _right;
+	std::vector<float> _interleaved;
+
+	// Output (at most one of these is open)
+	SNDFILE_tag *_sf;
+	FILE *_raw;
+
+	process_callback_t _callback;
+	void *_callback_arg;
+
+	std::atomic<uint32_t> _frame_time;    // frames since activate()
+	std::atomic<uint32_t> _segment_start;
+	std::atomic<float> _dsp_load;
+	};
+
+} // namespace StretchPlayer
+
+#endif // NULLAUDIOSYSTEM_HPP
@@ -0,0 +1,287 @@
+/*
+ * Copyright(c) 2010 by Gabriel M. Beddingfield <gabriel@teuton.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY, without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "OfflineRenderer.hpp"
+#include "DiskStreamer.hpp"
+#include <rubberband/RubberBandStretcher.h>
+#include <sndfile.h>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/time.h>
+
+using RubberBand::RubberBandStretcher;
+
+namespace StretchPlayer
+{
+	/* Frames per study(), process(), and write */
+	static const uint32_t RENDER_BLOCK = 16384;
+
+	/* Decode window of the input streamer, in seconds */
+	static const float RENDER_READ_AHEAD = 4.0;
+
+	/* Give up if the input makes no progress for this long */
+	static const double RENDER_READ_TIMEOUT = 10.0;
+
+	static double now()
+	{
+		timeval tv;
+		gettimeofday(&tv, 0);
+		return tv.tv_sec + tv.tv_usec / 1000000.0;
+	}
+
+	static bool ends_with(const char *str, const char *suffix)
+	{
+		size_t a = strlen(str), b = strlen(suffix);
+		return a >= b && strcasecmp(str + a - b, suffix) == 0;
+	}
+
+	/**
+	 * Read from a streamer, waiting for its reader thread.
+	 *
+	 * \return frames read.  0 at the end, or if the streamer is
+	 * stuck.
+	 */
+	static uint32_t read_blocking(DiskStreamer *song, unsigned long pos, long shift,
+				      float *&left, float *&right, uint32_t count)
+	{
+		uint32_t got;
+		double start = now();
+
+		while( (got = song->read(pos, shift, left, right, count)) == 0 ) {
+			if( pos >= song->frames() || now() - start > RENDER_READ_TIMEOUT ) {
+				return 0;
+			}
+			song->nudge();
+			usleep(1000);
+		}
+		return got;
+	}
+
+	OfflineRenderer::OfflineRenderer(bool threaded) :
+		_threaded(threaded),
+		_rate(0),
+		_channels(0),
+		_frames(0),
+		_start(0),
+		_last_report(0)
+	{
+		for( int k=0 ; k<2 ; ++k ) {
+			_in[k].resize(RENDER_BLOCK);
+			_out[k].resize(RENDER_BLOCK);
+		}
+		_interleaved.resize(2 * RENDER_BLOCK);
+	}
+
+	OfflineRenderer::~OfflineRenderer()
+	{
+	}
+
+	bool OfflineRenderer::render(const job_t& job, char *err_msg, size_t err_size)
+	{
+		DiskStreamer song;
+		SNDFILE *sf;
+		SF_INFO info;
+		bool ok;
+
+		if( ! song.open(job.input, RENDER_READ_AHEAD, std::abs(job.shift), job.mono,
+				err_msg, err_size) ) {
+			return false;
+		}
+
+		// Mono in, mono out... unless the channels are shifted.
+		int channels = 2;
+		if( (song.channels() == 1 || job.mono) && job.shift == 0 ) {
+			channels = 1;
+		}
+		float rate = song.sample_rate();
+
+		if( !_stretcher || _rate != rate || _channels != channels ) {
+			_stretcher.reset( new RubberBandStretcher(
+				rate,
+				channels,
+				RubberBandStretcher::OptionProcessOffline
+				| (_threaded ? RubberBandStretcher::OptionThreadingAlways
+				   : RubberBandStretcher::OptionThreadingNever)
+			));
+			_rate = rate;
+			_channels = channels;
+		} else {
+			_stretcher->reset();
+		}
+		_stretcher->setTimeRatio( 1.0 / job.stretch );
+		_stretcher->setPitchScale( ::pow(2.0, double(job.pitch)/12.0) );
+		_stretcher->setExpectedInputDuration( song.frames() );
+		_stretcher->setMaxProcessSize( RENDER_BLOCK );
+
+		memset(&info, 0, sizeof(info));
+		info.samplerate = rate;
+		info.channels = channels;
+		// Keep the stretcher's resolution.  FLAC can't hold
+		// floats, so that gets its widest integer format.
+		if( ends_with(job.output, ".flac") ) {
+			info.format = SF_FORMAT_FLAC | SF_FORMAT_PCM_24;
+		} else {
+			info.format = SF_FORMAT_WAV | SF_FORMAT_FLOAT;
+		}
+		sf = sf_open(job.output, SFM_WRITE, &info);
+		if( !sf ) {
+			snprintf(err_msg, err_size, "Error creating file '%s': %s",
+				 job.output, sf_strerror(0));
+			return false;
+		}
+		sf_command(sf, SFC_SET_CLIPPING, 0, SF_TRUE);
+
+		_frames = song.frames();
+		_start = now();
+		_last_report = _start;
+
+		ok = _study(&song, job, err_msg, err_size)
+			&& _process(&song, job, sf, err_msg, err_size);
+		if( sf_close(sf) != 0 && ok ) {
+			snprintf(err_msg, err_size, "Error writing file '%s'", job.output);
+			ok = false;
+		}
+		if( !ok ) {
+			unlink(job.output);
+			return false;
+		}
+		_report(2 * _frames, true);
+		return true;
+	}
+
+	/**
+	 * First pass: let the stretcher see the whole song.
+	 */
+	bool OfflineRenderer::_study(DiskStreamer *song, const job_t& job,
+				     char *err_msg, size_t err_size)
+	{
+		long shift = job.shift * _rate;
+		unsigned long pos = 0;
+		uint32_t n;
+
+		while( pos < _frames ) {
+			float *ptrs[2] = { &_in[0][0], &_in[1][0] };
+			n = read_blocking(song, pos, shift, ptrs[0], ptrs[1], RENDER_BLOCK);
+			if( n == 0 ) {
+				snprintf(err_msg, err_size, "Error reading file '%s'", job.input);
+				return false;
+			}
+			pos += n;
+			_stretcher->study(ptrs, n, pos >= _frames);
+			_report(pos, false);
+		}
+		return true;
+	}
+
+	/**
+	 * Second pass: stretch the song, writing the output as it
+	 * becomes available.
+	 */
+	bool OfflineRenderer::_process(DiskStreamer *song, const job_t& job, SNDFILE_tag *sf,
+				       char *err_msg, size_t err_size)
+	{
+		long shift = job.shift * _rate;
+		unsigned long pos = 0;
+		uint32_t n;
+		bool final = false;
+		int avail;
+
+		while( true ) {
+			if( !final ) {
+				float *ptrs[2] = { &_in[0][0], &_in[1][0] };
+				n = read_blocking(song, pos, shift, ptrs[0], ptrs[1], RENDER_BLOCK);
+				if( n == 0 ) {
+					snprintf(err_msg, err_size, "Error reading file '%s'", job.input);
+					return false;
+				}
+				pos += n;
+				final = pos >= _frames;
+				_stretcher->process(ptrs, n, final);
+				_report(_frames + pos, false);
+			}
+
+			// After the last block, the stretcher's threads may
+			// still be working.  available() is -1 when all of
+			// the output has been retrieved.
+			avail = _stretcher->available();
+			if( avail < 0 ) {
+				break;
+			}
+			if( avail == 0 ) {
+				if( final ) usleep(1000);
+				continue;
+			}
+			while( avail > 0 ) {
+				n = (avail < int(RENDER_BLOCK)) ? avail : RENDER_BLOCK;
+				float *ptrs[2] = { &_out[0][0], &_out[1][0] };
+				n = _stretcher->retrieve(ptrs, n);
+				if( !_write(sf, n) ) {
+					snprintf(err_msg, err_size, "Error writing file '%s': %s",
+						 job.output, sf_strerror(sf));
+					return false;
+				}
+				avail -= n;
+			}
+		}
+		return true;
+	}
+
+	bool OfflineRenderer::_write(SNDFILE_tag *sf, uint32_t count)
+	{
+		if( _channels == 1 ) {
+			return sf_writef_float(sf, &_out[0][0], count) == sf_count_t(count);
+		}
+		const float *left = &_out[0][0], *right = &_out[1][0];
+		float *dst = &_interleaved[0];
+		for( uint32_t k=0 ; k<count ; ++k ) {
+			dst[2*k] = left[k];
+			dst[2*k + 1] = right[k];
+		}
+		return sf_writef_float(sf, dst, count) == sf_count_t(count);
+	}
+
+	/**
+	 * Call the progress callback, at most 4 times a second unless
+	 * forced.
+	 *
+	 * \param done frames handled by both passes.
+	 */
+	void OfflineRenderer::_report(unsigned long done, bool force)
+	{
+		if( !_progress ) {
+			return;
+		}
+		double t = now();
+		if( !force && t - _last_report < 0.25 ) {
+			return;
+		}
+		_last_report = t;
+
+		float progress = double(done) / (2.0 * _frames);
+		float speed = 0.0;
+		if( t > _start ) {
+			speed = (done / 2.0) / _rate / (t - _start);
+		}
+		_progress(progress, speed);
+	}
+
+} // namespace StretchPlayer
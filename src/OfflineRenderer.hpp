@@ -0,0 +1,119 @@
+/*
+ * Copyright(c) 2010 by Gabriel M. Beddingfield <gabriel@teuton.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY, without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+#ifndef OFFLINERENDERER_HPP
+#define OFFLINERENDERER_HPP
+
+#include <stdint.h>
+#include <cstddef>
+#include <memory>
+#include <functional>
+#include <vector>
+
+struct SNDFILE_tag;
+
+namespace RubberBand
+{
+	class RubberBandStretcher;
+}
+
+namespace StretchPlayer
+{
+	class DiskStreamer;
+
+	/**
+	 * \brief Stretches a whole file into another, as fast as the
+	 * CPU allows.
+	 *
+	 * Unlike the Engine, this uses RubberBand's offline mode: the
+	 * whole song is studied first, then processed, which gives
+	 * better quality than the real-time mode.  The input is read
+	 * through a DiskStreamer, so --mono and --shift work as they
+	 * do for playback.  The output is written with libsndfile, as
+	 * 24 bit FLAC if the name ends in ".flac", otherwise as 32 bit
+	 * float WAV.
+	 *
+	 * A renderer keeps its stretcher between jobs, and reuses it
+	 * when the sample rate and channel count don't change.
+	 */
+	class OfflineRenderer
+	{
+	public:
+	typedef struct {
+		const char *input;
+		const char *output;
+		float stretch;  // playing speed (1.0 is normal)
+		int pitch;      // in semitones
+		int shift;      // see Engine::set_shift()
+		bool mono;
+	} job_t;
+
+	/**
+	 * Called now and then while rendering.
+	 *
+	 * \param progress [0.0, 1.0]
+	 * \param speed seconds of song rendered per second, so far.
+	 */
+	typedef std::function<void (float progress, float speed)> progress_callback_t;
+
+	/**
+	 * \param threaded let RubberBand process each channel in its
+	 * own thread.
+	 */
+	OfflineRenderer(bool threaded = true);
+	OfflineRenderer(const OfflineRenderer&) = delete;
+	~OfflineRenderer();
+
+	void set_progress_callback(const progress_callback_t& cb) {
+		_progress = cb;
+	}
+
+	/**
+	 * \return true on success.  On failure, err_msg (err_size
+	 * bytes) will have a description of the error, and the output
+	 * file is removed.
+	 */
+	bool render(const job_t& job, char *err_msg, size_t err_size);
+
+	private:
+	bool _study(DiskStreamer *song, const job_t& job, char *err_msg, size_t err_size);
+	bool _process(DiskStreamer *song, const job_t& job, SNDFILE_tag *sf,
+		      char *err_msg, size_t err_size);
+	bool _write(SNDFILE_tag *sf, uint32_t count);
+	void _report(unsigned long done, bool force);
+
+	private:
+	bool _threaded;
+	std::unique_ptr<RubberBand::RubberBandStretcher> _stretcher;
+	float _rate;
+	int _channels;
+	progress_callback_t _progress;
+
+	std::vector<float> _in[2];
+	std::vector<float> _out[2];
+	std::vector<float> _interleaved;
+
+	/* Progress.  Both passes count, so a song is 2 * _frames. */
+	unsigned long _frames;
+	double _start;         // seconds
+	double _last_report;   // seconds
+	};
+
+} // namespace StretchPlayer
+
+#endif // OFFLINERENDERER_HPP
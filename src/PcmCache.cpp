@@ -0,0 +1,364 @@
+/*
+ * Copyright(c) 2010 by Gabriel M. Beddingfield <gabriel@teuton.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY, without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "PcmCache.hpp"
+#include "MappedSong.hpp"
+#include "MemorySong.hpp"
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+
+namespace StretchPlayer
+{
+	static const char PCM_CACHE_MAGIC[8] = { 'S', 'P', 'P', 'C', 'M', 0, 0, 0 };
+	static const uint32_t PCM_CACHE_VERSION = 1;
+	static const char PCM_CACHE_SUFFIX[] = ".pcm";
+	static const char PCM_CACHE_TMP_SUFFIX[] = ".tmp"; // after ".<pid>"
+	static const uint32_t PCM_CACHE_BLOCK = 1 << 16; // frames per write
+
+	/* A cache file is this header, then the source's path, then
+	 * (at data_offset) each lane of frames floats.
+	 */
+	typedef struct _pcm_cache_header_t
+	{
+	char magic[8];
+	uint32_t version;
+	uint32_t lanes;       // 1 or 2
+	uint32_t channels;    // in the source file
+	float sample_rate;
+	uint64_t frames;
+	uint64_t source_size;
+	int64_t source_mtime;
+	uint32_t path_len;
+	uint32_t data_offset; // page aligned
+	} pcm_cache_header_t;
+
+	PcmCache::PcmCache(const char *dir, uint64_t budget) :
+		_dir(dir),
+		_budget(budget)
+	{
+		// mkdir -p
+		std::string::size_type pos = 0;
+		while (pos != std::string::npos) {
+			pos = _dir.find('/', pos + 1);
+			mkdir(_dir.substr(0, pos).c_str(), 0755);
+		}
+
+		// Clean up after writers that died.
+		_evict(std::string());
+	}
+
+	PcmCache::~PcmCache()
+	{
+	}
+
+	/**
+	 * Find the cache file for a source file.
+	 *
+	 * \return false if the source can't be stat'ed.
+	 */
+	bool PcmCache::_entry_path(const char *filename, std::string& entry, std::string& source,
+				   uint64_t& size, int64_t& mtime)
+	{
+		struct stat st;
+		char *real = realpath(filename, 0);
+
+		if (!real) {
+			return false;
+		}
+		source = real;
+		free(real);
+		if (stat(source.c_str(), &st) != 0) {
+			return false;
+		}
+		size = st.st_size;
+		mtime = st.st_mtime;
+
+		// FNV-1a over the whole key
+		uint64_t hash = 14695981039346656037ULL;
+		const unsigned char *p;
+		std::string::size_type k;
+		p = (const unsigned char*)source.c_str();
+		for (k = 0 ; k <= source.size() ; ++k) {
+			hash = (hash ^ p[k]) * 1099511628211ULL;
+		}
+		p = (const unsigned char*)&size;
+		for (k = 0 ; k < sizeof(size) ; ++k) {
+			hash = (hash ^ p[k]) * 1099511628211ULL;
+		}
+		p = (const unsigned char*)&mtime;
+		for (k = 0 ; k < sizeof(mtime) ; ++k) {
+			hash = (hash ^ p[k]) * 1099511628211ULL;
+		}
+
+		char name[32];
+		snprintf(name, sizeof(name), "/%016llx", (unsigned long long)hash);
+		entry = _dir + name + PCM_CACHE_SUFFIX;
+		return true;
+	}
+
+	Song* PcmCache::open(const char *filename, bool mono)
+	{
+		std::string entry, source;
+		uint64_t size;
+		int64_t mtime;
+		struct stat st;
+		int fd;
+		void *map;
+
+		if (!_entry_path(filename, entry, source, size, mtime)) {
+			return 0;
+		}
+		fd = ::open(entry.c_str(), O_RDONLY);
+		if (fd < 0) {
+			return 0;
+		}
+		if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(pcm_cache_header_t)) {
+			::close(fd);
+			return 0;
+		}
+		map = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (map == MAP_FAILED) {
+			::close(fd);
+			return 0;
+		}
+
+		// A stale or broken entry is removed, so that it gets
+		// rewritten.
+		const pcm_cache_header_t *hdr = (const pcm_cache_header_t*)map;
+		const char *path = (const char*)map + sizeof(pcm_cache_header_t);
+		if (memcmp(hdr->magic, PCM_CACHE_MAGIC, sizeof(PCM_CACHE_MAGIC)) != 0
+		    || hdr->version != PCM_CACHE_VERSION
+		    || hdr->lanes < 1 || hdr->lanes > 2
+		    || hdr->source_size != size
+		    || hdr->source_mtime != mtime
+		    || hdr->path_len != source.size()
+		    || sizeof(pcm_cache_header_t) + hdr->path_len > hdr->data_offset
+		    || (uint64_t)st.st_size != hdr->data_offset + hdr->lanes * hdr->frames * sizeof(float)
+		    || memcmp(path, source.c_str(), hdr->path_len) != 0) {
+			munmap(map, st.st_size);
+			::close(fd);
+			unlink(entry.c_str());
+			return 0;
+		}
+
+		const float *left = (const float*)((const char*)map + hdr->data_offset);
+		const float *right = (hdr->lanes > 1) ? left + hdr->frames : left;
+		madvise(map, st.st_size, MADV_WILLNEED);
+
+		// Mark it as recently used.
+		futimens(fd, 0);
+		::close(fd);
+
+		return new MappedSong(map, st.st_size, left, right, hdr->frames,
+				      hdr->sample_rate, hdr->channels, mono);
+	}
+
+	bool PcmCache::store(const char *filename, MemorySong& song, char *err_msg)
+	{
+		std::string entry, source, tmp;
+		pcm_cache_header_t hdr;
+		uint64_t size;
+		int64_t mtime;
+		FILE *f;
+		bool ok;
+
+		if (!_entry_path(filename, entry, source, size, mtime)) {
+			strcpy(err_msg, "Warning: could not cache file: can't stat source");
+			return false;
+		}
+
+		long page = sysconf(_SC_PAGESIZE);
+		memset(&hdr, 0, sizeof(hdr));
+		memcpy(hdr.magic, PCM_CACHE_MAGIC, sizeof(PCM_CACHE_MAGIC));
+		hdr.version = PCM_CACHE_VERSION;
+		hdr.lanes = (song.channels() > 1) ? 2 : 1;
+		hdr.channels = song.channels();
+		hdr.sample_rate = song.sample_rate();
+		hdr.frames = song.frames();
+		hdr.source_size = size;
+		hdr.source_mtime = mtime;
+		hdr.path_len = source.size();
+		hdr.data_offset = (sizeof(hdr) + hdr.path_len + page - 1) / page * page;
+
+		if (hdr.data_offset + hdr.lanes * hdr.frames * sizeof(float) > _budget) {
+			strcpy(err_msg, "Warning: file is too large for the cache");
+			return false;
+		}
+
+		// Write to a temporary file, then rename it into place
+		// so that a partial entry is never seen.
+		char suffix[32];
+		snprintf(suffix, sizeof(suffix), ".%d%s", (int)getpid(), PCM_CACHE_TMP_SUFFIX);
+		tmp = entry + suffix;
+		f = fopen(tmp.c_str(), "wb");
+		if (!f) {
+			strcpy(err_msg, "Warning: could not create cache file in ");
+			strncat(err_msg, _dir.c_str(), 512);
+			return false;
+		}
+		ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1
+			&& fwrite(source.c_str(), 1, hdr.path_len, f) == hdr.path_len
+			&& fseek(f, hdr.data_offset, SEEK_SET) == 0;
+
+		// Cache files are always float, whatever the song's
+		// storage.
+		std::vector<float> buf(PCM_CACHE_BLOCK);
+		uint32_t lane, n;
+		uint64_t pos;
+		for (lane = 0 ; ok && lane < hdr.lanes ; ++lane) {
+			for (pos = 0 ; ok && pos < hdr.frames ; pos += n) {
+				if (song.cancelled()) {
+					fclose(f);
+					unlink(tmp.c_str());
+					strcpy(err_msg, "Warning: cache file not written (cancelled)");
+					return false;
+				}
+				n = (hdr.frames - pos < PCM_CACHE_BLOCK) ? (hdr.frames - pos) : PCM_CACHE_BLOCK;
+				song.get(lane, pos, &buf[0], n);
+				ok = fwrite(&buf[0], sizeof(float), n, f) == n;
+			}
+		}
+		ok = (fclose(f) == 0) && ok;
+		if (!ok || rename(tmp.c_str(), entry.c_str()) != 0) {
+			unlink(tmp.c_str());
+			strcpy(err_msg, "Warning: could not write cache file in ");
+			strncat(err_msg, _dir.c_str(), 512);
+			return false;
+		}
+
+		_evict(entry);
+		return true;
+	}
+
+	typedef struct _pcm_cache_entry_t
+	{
+	time_t mtime;
+	uint64_t size;
+	std::string path;
+	} pcm_cache_entry_t;
+
+	static bool lru_order(const pcm_cache_entry_t& a, const pcm_cache_entry_t& b)
+	{
+		return a.mtime < b.mtime;
+	}
+
+	static bool has_suffix(const char *name, size_t len, const char *suffix)
+	{
+		size_t suffix_len = strlen(suffix);
+		return len > suffix_len && strcmp(name + len - suffix_len, suffix) == 0;
+	}
+
+	/**
+	 * Was a temporary file left by a process that is gone?
+	 *
+	 * Temporary files are named <entry>.<pid>.tmp.
+	 */
+	static bool stale_tmp(const char *name, size_t len)
+	{
+		size_t tmp_len = strlen(PCM_CACHE_TMP_SUFFIX);
+		const char *dot;
+		char *end;
+		long pid;
+
+		if (!has_suffix(name, len, PCM_CACHE_TMP_SUFFIX)) {
+			return false;
+		}
+		dot = (const char*)memrchr(name, '.', len - tmp_len);
+		if (!dot) {
+			return false;
+		}
+		pid = strtol(dot + 1, &end, 10);
+		if (end != name + len - tmp_len || pid <= 0) {
+			return false;
+		}
+		return kill(pid, 0) != 0 && errno == ESRCH;
+	}
+
+	/**
+	 * Delete least recently used entries until the cache is
+	 * within budget.  The entry keep is never deleted.
+	 *
+	 * Temporary files of writers that died are deleted, and
+	 * those still being written count against the budget.
+	 */
+	void PcmCache::_evict(const std::string& keep)
+	{
+		std::vector<pcm_cache_entry_t> entries;
+		uint64_t total = 0;
+		DIR *dir;
+		struct dirent *de;
+		struct stat st;
+		size_t len;
+
+		dir = opendir(_dir.c_str());
+		if (!dir) {
+			return;
+		}
+		while ((de = readdir(dir)) != 0) {
+			len = strlen(de->d_name);
+			if (stale_tmp(de->d_name, len)) {
+				unlink((_dir + "/" + de->d_name).c_str());
+				continue;
+			}
+			pcm_cache_entry_t e;
+			e.path = _dir + "/" + de->d_name;
+			if (has_suffix(de->d_name, len, PCM_CACHE_TMP_SUFFIX)) {
+				// Still being written
+				if (stat(e.path.c_str(), &st) == 0) {
+					total += st.st_size;
+				}
+				continue;
+			}
+			if (!has_suffix(de->d_name, len, PCM_CACHE_SUFFIX)
+			    || stat(e.path.c_str(), &st) != 0) {
+				continue;
+			}
+			e.mtime = st.st_mtime;
+			e.size = st.st_size;
+			total += e.size;
+			entries.push_back(e);
+		}
+		closedir(dir);
+
+		std::sort(entries.begin(), entries.end(), lru_order);
+		std::vector<pcm_cache_entry_t>::iterator it;
+		for (it = entries.begin() ; it != entries.end() && total > _budget ; ++it) {
+			if (it->path == keep) {
+				continue;
+			}
+			// Deleting a file that is mapped (i.e. playing)
+			// is fine.  The mapping stays valid.
+			if (unlink(it->path.c_str()) == 0) {
+				total -= it->size;
+			}
+		}
+	}
+
+} // namespace StretchPlayer
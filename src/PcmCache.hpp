@@ -0,0 +1,87 @@
+/*
+ * Copyright(c) 2010 by Gabriel M. Beddingfield <gabriel@teuton.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY, without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+#ifndef PCMCACHE_HPP
+#define PCMCACHE_HPP
+
+#include <string>
+#include <stdint.h>
+
+namespace StretchPlayer
+{
+	class Song;
+	class MemorySong;
+
+	/**
+	 * \brief On-disk cache of decoded audio.
+	 *
+	 * Decoding a long file takes a while.  After the first load,
+	 * the decoded (planar float) audio is written to a file in
+	 * the cache directory.  Later loads of the same file map the
+	 * cache file and play straight out of it (see MappedSong).
+	 *
+	 * Entries are keyed by the source's path, size, and
+	 * modification time, so editing the source invalidates its
+	 * entry.  When the cache grows past its budget, the least
+	 * recently used entries are deleted.  An entry's mtime is its
+	 * last use.  Entries are written to <entry>.<pid>.tmp and
+	 * renamed into place; a temporary file whose writer has died
+	 * is deleted the next time the cache is opened or evicted.
+	 *
+	 * Cache files are in native byte order and are not meant to
+	 * be portable.
+	 */
+	class PcmCache
+	{
+	public:
+	/**
+	 * \param dir cache directory (created if needed)
+	 * \param budget maximum total size of the cache, in bytes.
+	 */
+	PcmCache(const char *dir, uint64_t budget);
+	~PcmCache();
+
+	/**
+	 * Look up a file.
+	 *
+	 * \param mono mix down to mono as the song is played.
+	 * \return a song mapped from the cache, or 0 on a miss.
+	 */
+	Song* open(const char *filename, bool mono);
+
+	/**
+	 * Add a decoded song to the cache, then evict old entries to
+	 * stay within budget.  The song must not be mixed down yet.
+	 * Stops early if the song is cancelled.
+	 *
+	 * \return true on success
+	 */
+	bool store(const char *filename, MemorySong& song, char *err_msg);
+
+	private:
+	bool _entry_path(const char *filename, std::string& entry, std::string& source,
+			 uint64_t& size, int64_t& mtime);
+	void _evict(const std::string& keep);
+
+	std::string _dir;
+	uint64_t _budget;
+	};
+
+} // namespace StretchPlayer
+
+#endif // PCMCACHE_HPP
@@ -74,15 +74,15 @@ class RingBuffer
 	void get_write_vector (rw_vector *);
 
 	void decrement_read_idx (unsigned cnt) {
-		read_idx.store(read_idx.fetch_add(-(int)cnt) & size_mask);
+		read_idx.store((read_idx.load() - (int)cnt) & size_mask);
 	}
 
 	void increment_read_idx (unsigned cnt) {
-		read_idx.store(read_idx.fetch_add((int)cnt) & size_mask);
+		read_idx.store((read_idx.load() + (int)cnt) & size_mask);
 	}
 
 	void increment_write_idx (unsigned cnt) {
-		write_idx.store(write_idx.fetch_add((int)cnt) & size_mask);
+		write_idx.store((write_idx.load() + (int)cnt) & size_mask);
 	}
 
 	unsigned write_space () {
@@ -21,6 +21,7 @@
 #include <rubberband/RubberBandStretcher.h>
 #include <unistd.h>
 #include <cassert>
+#include <thread>
 #include <sys/time.h>
 
 using RubberBand::RubberBandStretcher;
@@ -31,9 +32,15 @@ namespace StretchPlayer
 	_running(true),
 	_stretcher_feed_block(512),
 	_cpu_load(0.0),
+	_param_seq(0),
 	_time_ratio_param(1.0),
 	_pitch_scale_param(1.0),
-	_reset_param(false)
+	_reset_req(0),
+	_reset_ack(0),
+	_output_mark(0),
+	_reset_seen(0),
+	_cycles(0),
+	_segment_size_param(512)
 	{
 	}
 
@@ -51,11 +58,6 @@ namespace StretchPlayer
 
 	_stretcher->setMaxProcessSize(MAXBUF*4);
 
-	_inputs[0] = std::move(std::unique_ptr<ringbuffer_t>(new ringbuffer_t(MAXBUF*4)));
-	_inputs[1] = std::move(std::unique_ptr<ringbuffer_t>(new ringbuffer_t(MAXBUF*4)));
-	_outputs[0] = std::move(std::unique_ptr<ringbuffer_t>(new ringbuffer_t(MAXBUF*4)));
-	_outputs[1] = std::move(std::unique_ptr<ringbuffer_t>(new ringbuffer_t(MAXBUF*4)));
-
 	_proc_time.insert( _proc_time.end(), 64, 0 );
 	_idle_time.insert( _idle_time.end(), 64, 0 );
 	}
@@ -93,37 +95,103 @@ namespace StretchPlayer
 			t.join();
 	}
 
+	/**
+	 * Ask the worker to reset the stretcher and empty the rings.
+	 * [RT SAFE]
+	 *
+	 * Returns at once.  Until the worker has done it, nothing can
+	 * be written or read.
+	 */
 	void RubberBandServer::reset()
 	{
-	std::lock_guard<std::mutex> lk(_param_mutex);
-	_reset_param = true;
-	for(size_t k=0 ; k < _proc_time.size() ; ++k) {
-		_proc_time[k] = 0;
-		_idle_time[k] = 0;
-	}
+	_reset_req.fetch_add(1, std::memory_order_release);
 	_wait_cond.notify_one();
 	}
 
+	bool RubberBandServer::_reset_pending() const
+	{
+	return _reset_req.load(std::memory_order_acquire)
+		!= _reset_ack.load(std::memory_order_acquire);
+	}
+
+	/**
+	 * Audio thread's half of a reset.  [RT SAFE]
+	 *
+	 * \return false while a reset is pending.  After the worker
+	 * has done it, drops the output it made before the reset.
+	 */
+	bool RubberBandServer::_audio_ready()
+	{
+	unsigned ack = _reset_ack.load(std::memory_order_acquire);
+	if(_reset_req.load(std::memory_order_acquire) != ack)
+		return false;
+	if(ack != _reset_seen) {
+		_output.discard_to(_output_mark.load(std::memory_order_relaxed));
+		_reset_seen = ack;
+	}
+	return true;
+	}
+
+	/**
+	 * Set the time ratio. [RT SAFE]
+	 */
 	void RubberBandServer::time_ratio(float val)
 	{
-	std::lock_guard<std::mutex> lk(_param_mutex);
-	_time_ratio_param = val;
+	if(val == _time_ratio_param.load(std::memory_order_relaxed))
+		return;
+	unsigned seq = _param_seq.load(std::memory_order_relaxed);
+	_param_seq.store(seq + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	_time_ratio_param.store(val, std::memory_order_relaxed);
+	_param_seq.store(seq + 2, std::memory_order_release);
 	}
 
 	float RubberBandServer::time_ratio()
 	{
-	return _time_ratio_param;
+	return _time_ratio_param.load(std::memory_order_relaxed);
 	}
 
+	/**
+	 * Set the pitch scale. [RT SAFE]
+	 */
 	void RubberBandServer::pitch_scale(float val)
 	{
-	std::lock_guard<std::mutex> lk(_param_mutex);
-	_pitch_scale_param = val;
+	if(val == _pitch_scale_param.load(std::memory_order_relaxed))
+		return;
+	unsigned seq = _param_seq.load(std::memory_order_relaxed);
+	_param_seq.store(seq + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	_pitch_scale_param.store(val, std::memory_order_relaxed);
+	_param_seq.store(seq + 2, std::memory_order_release);
 	}
 
 	float RubberBandServer::pitch_scale()
 	{
-	return _pitch_scale_param;
+	return _pitch_scale_param.load(std::memory_order_relaxed);
+	}
+
+	/**
+	 * Read the parameter mailbox (worker thread).
+	 *
+	 * \param seq the sequence number last seen.  Updated.
+	 * \return true if the parameters changed since seq.
+	 */
+	bool RubberBandServer::_read_params(unsigned& seq, float& time_ratio, float& pitch_scale)
+	{
+	unsigned before, after;
+
+	do {
+		before = _param_seq.load(std::memory_order_acquire);
+		if(before == seq)
+		return false;
+		time_ratio = _time_ratio_param.load(std::memory_order_relaxed);
+		pitch_scale = _pitch_scale_param.load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		after = _param_seq.load(std::memory_order_relaxed);
+	} while( (before & 1) || (before != after) );
+
+	seq = after;
+	return true;
 	}
 
 	void RubberBandServer::go_idle()
@@ -136,17 +204,16 @@ namespace StretchPlayer
 	//setPriority(QThread::TimeCriticalPriority);
 	}
 
+	/**
+	 * Change the feed block size.
+	 *
+	 * The worker applies it along
+	 * with a reset, so this returns without waiting.
+	 */
 	void RubberBandServer::set_segment_size(unsigned long nframes)
 	{
-	while(_reset_param)
-		usleep(100);
-
-	if(nframes == _stretcher_feed_block)
-		return;
-
 	if( nframes <= 512 ) {
-		_stretcher_feed_block = 512;
-		return;
+		nframes = 512;
 	}
 	// Round up to next power of 2
 	if( (nframes - 1) & nframes ) {
@@ -159,25 +226,51 @@ namespace StretchPlayer
 	if( nframes > (1L<<14) ) {
 		nframes = (1L<<14);
 	}
-	_stretcher_feed_block = nframes;
+	if( nframes == _segment_size_param.load(std::memory_order_relaxed) )
+		return;
 
+	_segment_size_param.store(nframes, std::memory_order_relaxed);
 	reset();
-	_stretcher->setMaxProcessSize(nframes * 4);
-	_inputs[0].reset( new ringbuffer_t(nframes * 4) );
-	_inputs[1].reset( new ringbuffer_t(nframes * 4) );
-	_outputs[0].reset( new ringbuffer_t(nframes * 4) );
-	_outputs[1].reset( new ringbuffer_t(nframes * 4) );
+	}
+
+	/**
+	 * Carry out a reset request (worker thread).
+	 */
+	void RubberBandServer::_apply_reset()
+	{
+	unsigned req = _reset_req.load(std::memory_order_acquire);
+	unsigned long nframes = _segment_size_param.load(std::memory_order_relaxed);
+
+	if( nframes != _stretcher_feed_block.load(std::memory_order_relaxed) ) {
+		if( nframes > 512 ) {
+		_stretcher->setMaxProcessSize(nframes * 4);
+		}
+		_stretcher_feed_block.store(nframes, std::memory_order_relaxed);
+	}
+
+	// The audio thread may be in the middle of writing _input or
+	// reading _output, so each side only moves its own index.
+	// The worker drops the input it hasn't read, and the audio
+	// thread drops the output up to the mark (see _audio_ready()).
+	_stretcher->reset();
+	_input.discard();
+	_output_mark.store(_output.write_idx(), std::memory_order_relaxed);
+	for(size_t k=0 ; k < _proc_time.size() ; ++k) {
+		_proc_time[k] = 0;
+		_idle_time[k] = 0;
+	}
 
+	_reset_ack.store(req, std::memory_order_release);
 	}
 
 	uint32_t RubberBandServer::feed_block_min() const
 	{
-	return _stretcher_feed_block;
+	return _stretcher_feed_block.load(std::memory_order_relaxed);
 	}
 
 	uint32_t RubberBandServer::feed_block_max() const
 	{
-	return 2 * _stretcher_feed_block;
+	return 2 * _stretcher_feed_block.load(std::memory_order_relaxed);
 	}
 
 	uint32_t RubberBandServer::latency() const
@@ -187,60 +280,45 @@ namespace StretchPlayer
 
 	uint32_t RubberBandServer::available_write()
 	{
-	if(_reset_param)
+	if(!_audio_ready())
 		return 0;
-	uint32_t l, r;
-	l = _inputs[0]->write_space();
-	r = _inputs[1]->write_space();
-	return (l < r) ? l : r;
+	return _input.write_space();
 	}
 
 	uint32_t RubberBandServer::written()
 	{
-	if(_reset_param)
+	if(!_audio_ready())
 		return 0;
-	uint32_t l, r;
-	l = _inputs[0]->read_space();
-	r = _inputs[1]->read_space();
-	return (l > r) ? l : r;
+	return _input.read_space();
 	}
 
 	uint32_t RubberBandServer::write_audio(float* left, float* right, uint32_t count)
 	{
-	if(_reset_param)
+	if(!_audio_ready())
 		return 0;
-	unsigned l, r, max = available_write();
-	if( count > max ) count = max;
-	l = _inputs[0]->write(left, count);
-	r = _inputs[1]->write(right, count);
+	const float *src[2] = { left, right };
+	unsigned n = _input.write(src, count);
 	_wait_cond.notify_one();
 	// _have_new_data.wakeAll();
-	assert( l == r );
-	return l;
+	return n;
 	}
 
 	uint32_t RubberBandServer::available_read()
 	{
-	if(_reset_param)
+	if(!_audio_ready())
 		return 0;
-	unsigned l, r;
-	l = _outputs[0]->read_space();
-	r = _outputs[1]->read_space();
-	return (l<r) ? l : r;
+	return _output.read_space();
 	}
 
 	uint32_t RubberBandServer::read_audio(float* left, float* right, uint32_t count)
 	{
-	if(_reset_param)
+	if(!_audio_ready())
 		return 0;
-	unsigned l, r, max = available_read();
-	if( count > max ) count = max;
-	l = _outputs[0]->read(left, count);
-	r = _outputs[1]->read(right, count);
+	float *dst[2] = { left, right };
+	unsigned n = _output.read(dst, count);
 	_wait_cond.notify_one();
 	// _room_for_output.wakeAll();
-	assert( l == r );
-	return l;
+	return n;
 	}
 
 	void RubberBandServer::nudge()
@@ -248,6 +326,30 @@ namespace StretchPlayer
 	_wait_cond.notify_one();
 	}
 
+	/**
+	 * Wait until count frames can be read, or the worker has done
+	 * all it can with the input written so far.
+	 *
+	 * NOT RT SAFE.  This spins until the worker catches up, so it
+	 * is only for free-running audio systems.
+	 */
+	void RubberBandServer::sync(uint32_t count)
+	{
+	unsigned c = _cycles.load(std::memory_order_acquire);
+
+	while( _running && available_read() < count ) {
+		if( written() ) {
+			c = _cycles.load(std::memory_order_acquire);
+		} else if( _cycles.load(std::memory_order_acquire) - c >= 2 ) {
+			// The input ran out partway through a loop,
+			// and a whole loop has run since.
+			break;
+		}
+		nudge();
+		std::this_thread::yield();
+	}
+	}
+
 	float RubberBandServer::cpu_load() const
 	{
 	return _cpu_load;
@@ -273,57 +375,41 @@ namespace StretchPlayer
 
 	void RubberBandServer::run()
 	{
-	uint32_t read_l, read_r, nget;
-	uint32_t write_l, write_r, nput;
+	uint32_t nget;
+	uint32_t nput;
 	uint32_t tmp;
-	const unsigned BUFSIZE = (1L<<15);
-	float* bufs[2];
-	float left[BUFSIZE], right[BUFSIZE];
-	float time_ratio, pitch_scale;
-	bool reset;
+	ringbuffer_t::rw_vector vec;
+	const float* in[2];
+	float* out[2];
+	float time_ratio = 1.0, pitch_scale = 1.0;
+	unsigned param_seq;
 	bool proc_output;
 	int cpu_load_pos = 0;
 	timeval a, b, c;
 
-	bufs[0] = left;
-	bufs[1] = right;
-
-	{
-		std::lock_guard<std::mutex> lk(_param_mutex);
-		time_ratio = _time_ratio_param;
-		pitch_scale = _pitch_scale_param;
-	}
+	// Never a valid sequence (it's odd), so the first
+	// parameters are always applied.
+	param_seq = ~0u;
 
 	size_t samples_required;
 	int samples_available;
 	while(_running) {
 		gettimeofday(&a, 0);
 
-		{
-			// Update stretcher parameters
-			std::lock_guard<std::mutex> lk(_param_mutex);
-			time_ratio = _time_ratio_param;
-			pitch_scale = _pitch_scale_param;
-			reset = _reset_param;
-			if(reset) {
-				_stretcher->reset();
-				_inputs[0]->reset();
-				_inputs[1]->reset();
-				_outputs[0]->reset();
-				_outputs[1]->reset();
-			}
-			_reset_param = false;
+		// Handle commands, then update stretcher parameters
+		if(_reset_pending()) {
+			_apply_reset();
+		}
+		if(_read_params(param_seq, time_ratio, pitch_scale)) {
+			_stretcher->setTimeRatio(time_ratio);
+			_stretcher->setPitchScale(pitch_scale);
 		}
-		_stretcher->setTimeRatio(time_ratio);
-		_stretcher->setPitchScale(pitch_scale);
 
 		// Get input audio and put them into the stretcher
-		read_l = _inputs[0]->read_space();
-		read_r = _inputs[1]->read_space();
-		nget = (read_l < read_r) ? read_l : read_r;
+		nget = _input.read_space();
 		samples_required = _stretcher->getSamplesRequired();
 		samples_available = _stretcher->available();
-		samples_available += available_read();
+		samples_available += _output.read_space(); // not available_read(), that's the audio side
 		if(nget) {
 		if(nget > feed_block_min())
 			nget = feed_block_min();
@@ -335,27 +421,35 @@ namespace StretchPlayer
 			nget = 0;
 		}
 		}
-		if(nget) {
-		tmp = _inputs[0]->read(left, nget);
-		assert( tmp == nget );
-		tmp = _inputs[1]->read(right, nget);
-		assert( tmp == nget );
+		// The stretcher reads straight out of the ring.  When
+		// the data wraps, it gets two calls.
+		_input.get_read_vector(&vec);
+		assert( nget <= vec.len[0] + vec.len[1] );
+		tmp = (nget < vec.len[0]) ? nget : vec.len[0];
+		in[0] = vec.buf[0][0];
+		in[1] = vec.buf[1][0];
+		_stretcher->process(in, tmp, false); // Must call even if nget == 0
+		if(nget > tmp) {
+		in[0] = vec.buf[0][1];
+		in[1] = vec.buf[1][1];
+		_stretcher->process(in, nget - tmp, false);
 		}
-		_stretcher->process(bufs, nget, false); // Must call even if nget == 0
+		_input.increment_read_idx(nget);
 
-		// Take output audio from stretcher and put on output buffers
+		// Take output audio from stretcher and put it straight
+		// into the output ring
 		proc_output = false;
 		nput = 1;
 		while(_stretcher->available() > 0 && nput) {
-		write_l = _outputs[0]->write_space();
-		write_r = _outputs[1]->write_space();
-		nput = (write_l < write_r) ? write_l : write_r;
+		_output.get_write_vector(&vec);
+		nput = vec.len[0];
 		if(nput) {
 			proc_output = true;
 			if(nput > feed_block_max()) nput = feed_block_max();
-			tmp = _stretcher->retrieve(bufs, nput);
-			_outputs[0]->write(left, tmp);
-			_outputs[1]->write(right, tmp);
+			out[0] = vec.buf[0][0];
+			out[1] = vec.buf[1][0];
+			tmp = _stretcher->retrieve(out, nput);
+			_output.increment_write_idx(tmp);
 		}
 		}
 
@@ -377,6 +471,7 @@ namespace StretchPlayer
 		if(cpu_load_pos >= _proc_time.size())
 		cpu_load_pos = 0;
 		_update_cpu_load();
+		_cycles.fetch_add(1, std::memory_order_release);
 	}
 	}
 
@@ -22,9 +22,10 @@
 #include <stdint.h>
 #include <memory>
 #include <thread>
-#include "RingBuffer.hpp"
+#include "MultiRingBuffer.hpp"
 #include <mutex>
 #include <condition_variable>
+#include <atomic>
 #include <vector>
 
 namespace RubberBand
@@ -42,7 +43,10 @@ namespace StretchPlayer
 	class RubberBandServer
 	{
 	public:
-	typedef Tritium::RingBuffer<float> ringbuffer_t;
+	/* Big enough for 4 feed blocks at the largest segment size
+	 * (see set_segment_size()).
+	 */
+	typedef MultiRingBuffer<float, 2, (1<<16)> ringbuffer_t;
 
 	RubberBandServer();
 	RubberBandServer(const RubberBandServer &tt) = delete;
@@ -69,6 +73,7 @@ namespace StretchPlayer
 	uint32_t feed_block_min() const;
 	uint32_t feed_block_max() const;
 	void nudge(); // Wake up thread in case it's sleeping.
+	void sync(uint32_t count);
 	uint32_t latency() const;
 	uint32_t written();
 	uint32_t available_write();
@@ -81,15 +86,19 @@ namespace StretchPlayer
 	virtual void run();
 	void _process();
 	void _update_cpu_load();
+	bool _reset_pending() const;
+	bool _audio_ready();
+	bool _read_params(unsigned& seq, float& time_ratio, float& pitch_scale);
+	void _apply_reset();
 
 	private:
 	friend class RubberBandServerFunc;
 	std::thread t;
 	bool _running;
 	std::unique_ptr< RubberBand::RubberBandStretcher > _stretcher;
-	std::unique_ptr< ringbuffer_t > _inputs[2];
-	std::unique_ptr< ringbuffer_t > _outputs[2];
-	unsigned long _stretcher_feed_block;
+	ringbuffer_t _input;  // stereo, one index pair
+	ringbuffer_t _output;
+	std::atomic<unsigned long> _stretcher_feed_block;
 
 	mutable std::condition_variable _wait_cond;
 	mutable std::mutex _wait_mutex;
@@ -98,10 +107,30 @@ namespace StretchPlayer
 	std::vector<uint32_t> _idle_time; // usecs
 	float _cpu_load; // [0.0, 1.0]
 
-	mutable std::mutex _param_mutex; // Must be locked for these params:
-	float _time_ratio_param;
-	float _pitch_scale_param;
-	bool _reset_param;
+	/* Parameter mailbox.  The setter makes _param_seq odd, writes
+	 * the values, then makes it even again.  The worker retries
+	 * if the sequence was odd or changed while it read, and only
+	 * touches the stretcher when the sequence has moved.  Only
+	 * one thread (the audio thread) may set parameters.
+	 */
+	std::atomic<unsigned> _param_seq;
+	std::atomic<float> _time_ratio_param;
+	std::atomic<float> _pitch_scale_param;
+
+	/* Commands.  reset() bumps _reset_req; the worker resets the
+	 * stretcher, empties _input, marks where the stale _output
+	 * ends, then copies _reset_req to _reset_ack.  The audio and
+	 * feed methods do nothing while they differ.  When the audio
+	 * thread sees a new ack (_reset_seen), it drops _output up to
+	 * the mark.  A new segment size is applied with the next
+	 * reset.
+	 */
+	std::atomic<unsigned> _reset_req;
+	std::atomic<unsigned> _reset_ack;
+	std::atomic<unsigned> _output_mark;
+	unsigned _reset_seen; // audio thread only
+	std::atomic<unsigned> _cycles; // worker loop iterations, for sync()
+	std::atomic<unsigned long> _segment_size_param;
 	};
 
 } // namespace StretchPlayer
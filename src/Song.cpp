@@ -0,0 +1,61 @@
+/*
+ * Copyright(c) 2010 by Gabriel M. Beddingfield <gabriel@teuton.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY, without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "Song.hpp"
+#include <cstring>
+
+namespace StretchPlayer
+{
+	void Song::copy_lane(float *dst, const float *lane, unsigned long frames,
+			     unsigned long pos, uint32_t count)
+	{
+		uint32_t avail = 0;
+		if (pos < frames) {
+			avail = (frames - pos < count) ? (frames - pos) : count;
+			memcpy(dst, lane + pos, avail * sizeof(float));
+		}
+		memset(dst + avail, 0, (count - avail) * sizeof(float));
+	}
+
+	void Song::mix_lanes(float *dst, const float *left, const float *right,
+			     unsigned long frames, unsigned long pos, uint32_t count)
+	{
+		uint32_t k, avail = 0;
+		if (pos < frames) {
+			avail = (frames - pos < count) ? (frames - pos) : count;
+			left += pos;
+			right += pos;
+			for (k = 0 ; k < avail ; ++k) {
+				dst[k] = (left[k] + right[k]) / 2.f;
+			}
+		}
+		memset(dst + avail, 0, (count - avail) * sizeof(float));
+	}
+
+	float* Song::lane_at(float *scratch, const float *lane, unsigned long frames,
+			     unsigned long pos, uint32_t count)
+	{
+		if (pos + count <= frames) {
+			return const_cast<float*>(lane + pos);
+		}
+		copy_lane(scratch, lane, frames, pos, count);
+		return scratch;
+	}
+
+} // namespace StretchPlayer
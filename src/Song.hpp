@@ -0,0 +1,103 @@
+/*
+ * Copyright(c) 2010 by Gabriel M. Beddingfield <gabriel@teuton.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY, without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+#ifndef SONG_HPP
+#define SONG_HPP
+
+#include <stdint.h>
+
+namespace StretchPlayer
+{
+	/**
+	 * \brief Pure virtual interface to a loaded song.
+	 *
+	 * A Song is built completely (decoded, opened, etc.) by a
+	 * non-realtime thread and then handed to the Engine.  After
+	 * that, the audio thread is the only one that calls read().
+	 *
+	 * Like the rest of the engine, a Song presents two channels.
+	 * Mono files are presented on both.
+	 */
+	class Song
+	{
+	public:
+	virtual ~Song() {}
+
+	/**
+	 * Length of the song, in frames.
+	 */
+	virtual unsigned long frames() const = 0;
+
+	virtual float sample_rate() const = 0;
+
+	/**
+	 * Number of channels in the source file.
+	 */
+	virtual int channels() const = 0;
+
+	/**
+	 * Get count frames of audio starting at frame pos. [RT SAFE]
+	 *
+	 * On entry, left and right point to scratch buffers that can
+	 * hold count floats.  On return, they point to the audio.
+	 * The song may either fill the scratch buffers or point
+	 * directly into its own storage.  Either way, the data is
+	 * only valid until the next call to read().
+	 *
+	 * If shift is non-zero, one channel is read |shift| frames
+	 * ahead of the other (right for positive, left for
+	 * negative).  See Engine::set_shift().
+	 *
+	 * \return number of frames available.  This is less than
+	 * count at the end of the song, or if the song isn't able to
+	 * deliver the audio yet (e.g. when streaming from disk).
+	 */
+	virtual uint32_t read(unsigned long pos, long shift, float *&left, float *&right, uint32_t count) = 0;
+
+	/**
+	 * False if read() follows a single read position, so that
+	 * reading from two places in turn makes each one start over.
+	 * The engine then never reads the song at two places at once.
+	 */
+	virtual bool random_access() const {
+		return true;
+	}
+
+	protected:
+	/**
+	 * Helpers for read(), for songs stored as planar float.  Both
+	 * write count frames (starting at frame pos of a song that is
+	 * frames long) to dst.  Frames past the end are silence.
+	 */
+	static void copy_lane(float *dst, const float *lane, unsigned long frames,
+			      unsigned long pos, uint32_t count);
+	static void mix_lanes(float *dst, const float *left, const float *right,
+			      unsigned long frames, unsigned long pos, uint32_t count);
+
+	/**
+	 * Point at count frames of lane starting at pos.  If any of
+	 * them are past the end, they're copied to scratch and padded
+	 * with silence.
+	 */
+	static float* lane_at(float *scratch, const float *lane, unsigned long frames,
+			      unsigned long pos, uint32_t count);
+	};
+
+} // namespace StretchPlayer
+
+#endif // SONG_HPP
@@ -0,0 +1,313 @@
+/*
+ * Copyright(c) 2011 by Gabriel M. Beddingfield <gabriel@teuton.org>
+ *
+ * This file is part of BAMS (Basic Audio Mixing Subroutines)
+ *
+ * BAMS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Tritium is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY, without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "bams_deinterleave.h"
+
+#include <assert.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BAMS_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+#if defined __cplusplus
+extern "C"
+{
+#endif
+
+#define S16_SCALING (1.0f / 32768.0f)
+
+typedef void (*deinterleave_float_t)(float * const *dst, int dst_channels,
+				     const float *src, int src_channels,
+				     unsigned long count);
+typedef void (*deinterleave_s16_t)(float * const *dst, int dst_channels,
+				   const int16_t *src, int src_channels,
+				   unsigned long count);
+
+/* Generic (scalar) versions.  These handle any channel layout.
+ */
+
+static void
+deinterleave_float_c(float * const *dst, int dst_channels,
+		     const float *src, int src_channels,
+		     unsigned long count)
+{
+	const float *s;
+	float *d;
+	unsigned long k;
+	int c;
+
+	assert(dst_channels <= src_channels);
+	if(src_channels == 1) {
+		memcpy(dst[0], src, count * sizeof(float));
+		return;
+	}
+	for(c = 0 ; c < dst_channels ; ++c) {
+		d = dst[c];
+		s = src + c;
+		for(k = 0 ; k < count ; ++k) {
+			d[k] = *s;
+			s += src_channels;
+		}
+	}
+}
+
+static void
+deinterleave_s16_c(float * const *dst, int dst_channels,
+		   const int16_t *src, int src_channels,
+		   unsigned long count)
+{
+	const int16_t *s;
+	float *d;
+	unsigned long k;
+	int c;
+
+	assert(dst_channels <= src_channels);
+	for(c = 0 ; c < dst_channels ; ++c) {
+		d = dst[c];
+		s = src + c;
+		for(k = 0 ; k < count ; ++k) {
+			d[k] = (float)(*s) * S16_SCALING;
+			s += src_channels;
+		}
+	}
+}
+
+#ifdef BAMS_X86_SIMD
+
+/* SSE2 versions.  Mono and stereo sources are vectorized, the
+ * rest go to the generic versions.
+ */
+
+__attribute__((target("sse2")))
+static void
+deinterleave_float_sse2(float * const *dst, int dst_channels,
+			const float *src, int src_channels,
+			unsigned long count)
+{
+	float *l, *r;
+	unsigned long k, n;
+	__m128 a, b;
+
+	if(src_channels != 2) {
+		deinterleave_float_c(dst, dst_channels, src, src_channels, count);
+		return;
+	}
+	l = dst[0];
+	r = (dst_channels > 1) ? dst[1] : 0;
+	n = count & ~3UL;
+	for(k = 0 ; k < n ; k += 4) {
+		a = _mm_loadu_ps(src + 2*k);
+		b = _mm_loadu_ps(src + 2*k + 4);
+		_mm_storeu_ps(l + k, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+		if(r)
+			_mm_storeu_ps(r + k, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+	}
+	for( ; k < count ; ++k) {
+		l[k] = src[2*k];
+		if(r)
+			r[k] = src[2*k + 1];
+	}
+}
+
+__attribute__((target("sse2")))
+static void
+deinterleave_s16_sse2(float * const *dst, int dst_channels,
+		      const int16_t *src, int src_channels,
+		      unsigned long count)
+{
+	float *l, *r;
+	unsigned long k, n;
+	const __m128 scale = _mm_set1_ps(S16_SCALING);
+	__m128i x;
+
+	l = dst[0];
+	if(src_channels == 1) {
+		n = count & ~7UL;
+		for(k = 0 ; k < n ; k += 8) {
+			x = _mm_loadu_si128((const __m128i*)(src + k));
+			/* Sign-extend by placing each sample in the top
+			 * half of a 32-bit word and shifting down.
+			 */
+			_mm_storeu_ps(l + k, _mm_mul_ps(scale,
+				_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16))));
+			_mm_storeu_ps(l + k + 4, _mm_mul_ps(scale,
+				_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16))));
+		}
+		for( ; k < count ; ++k)
+			l[k] = (float)src[k] * S16_SCALING;
+		return;
+	}
+	if(src_channels != 2) {
+		deinterleave_s16_c(dst, dst_channels, src, src_channels, count);
+		return;
+	}
+	r = (dst_channels > 1) ? dst[1] : 0;
+	n = count & ~3UL;
+	for(k = 0 ; k < n ; k += 4) {
+		/* Each 32-bit word is one frame: left in the low
+		 * half, right in the high half.
+		 */
+		x = _mm_loadu_si128((const __m128i*)(src + 2*k));
+		_mm_storeu_ps(l + k, _mm_mul_ps(scale,
+			_mm_cvtepi32_ps(_mm_srai_epi32(_mm_slli_epi32(x, 16), 16))));
+		if(r)
+			_mm_storeu_ps(r + k, _mm_mul_ps(scale,
+				_mm_cvtepi32_ps(_mm_srai_epi32(x, 16))));
+	}
+	for( ; k < count ; ++k) {
+		l[k] = (float)src[2*k] * S16_SCALING;
+		if(r)
+			r[k] = (float)src[2*k + 1] * S16_SCALING;
+	}
+}
+
+/* AVX2 versions.
+ */
+
+__attribute__((target("avx2")))
+static void
+deinterleave_float_avx2(float * const *dst, int dst_channels,
+			const float *src, int src_channels,
+			unsigned long count)
+{
+	float *l, *r;
+	unsigned long k, n;
+	__m256 a, b, v;
+
+	if(src_channels != 2) {
+		deinterleave_float_c(dst, dst_channels, src, src_channels, count);
+		return;
+	}
+	l = dst[0];
+	r = (dst_channels > 1) ? dst[1] : 0;
+	n = count & ~7UL;
+	for(k = 0 ; k < n ; k += 8) {
+		a = _mm256_loadu_ps(src + 2*k);
+		b = _mm256_loadu_ps(src + 2*k + 8);
+		/* The shuffle works within 128-bit lanes, which
+		 * leaves the 64-bit pairs in the order 0, 2, 1, 3.
+		 */
+		v = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+		v = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(v), _MM_SHUFFLE(3, 1, 2, 0)));
+		_mm256_storeu_ps(l + k, v);
+		if(r) {
+			v = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+			v = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(v), _MM_SHUFFLE(3, 1, 2, 0)));
+			_mm256_storeu_ps(r + k, v);
+		}
+	}
+	for( ; k < count ; ++k) {
+		l[k] = src[2*k];
+		if(r)
+			r[k] = src[2*k + 1];
+	}
+}
+
+__attribute__((target("avx2")))
+static void
+deinterleave_s16_avx2(float * const *dst, int dst_channels,
+		      const int16_t *src, int src_channels,
+		      unsigned long count)
+{
+	float *l, *r;
+	unsigned long k, n;
+	const __m256 scale = _mm256_set1_ps(S16_SCALING);
+	__m256i x;
+
+	l = dst[0];
+	if(src_channels == 1) {
+		n = count & ~7UL;
+		for(k = 0 ; k < n ; k += 8) {
+			x = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(src + k)));
+			_mm256_storeu_ps(l + k, _mm256_mul_ps(scale, _mm256_cvtepi32_ps(x)));
+		}
+		for( ; k < count ; ++k)
+			l[k] = (float)src[k] * S16_SCALING;
+		return;
+	}
+	if(src_channels != 2) {
+		deinterleave_s16_c(dst, dst_channels, src, src_channels, count);
+		return;
+	}
+	r = (dst_channels > 1) ? dst[1] : 0;
+	n = count & ~7UL;
+	for(k = 0 ; k < n ; k += 8) {
+		x = _mm256_loadu_si256((const __m256i*)(src + 2*k));
+		_mm256_storeu_ps(l + k, _mm256_mul_ps(scale,
+			_mm256_cvtepi32_ps(_mm256_srai_epi32(_mm256_slli_epi32(x, 16), 16))));
+		if(r)
+			_mm256_storeu_ps(r + k, _mm256_mul_ps(scale,
+				_mm256_cvtepi32_ps(_mm256_srai_epi32(x, 16))));
+	}
+	for( ; k < count ; ++k) {
+		l[k] = (float)src[2*k] * S16_SCALING;
+		if(r)
+			r[k] = (float)src[2*k + 1] * S16_SCALING;
+	}
+}
+
+#endif /* BAMS_X86_SIMD */
+
+/* Runtime selection.  The function pointers start out at the
+ * portable versions, and are set once for this CPU before main()
+ * runs, so parallel decoders never race to set them.
+ */
+
+static deinterleave_float_t deinterleave_float_impl = deinterleave_float_c;
+static deinterleave_s16_t deinterleave_s16_impl = deinterleave_s16_c;
+
+#ifdef BAMS_X86_SIMD
+__attribute__((constructor))
+static void
+deinterleave_select(void)
+{
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2")) {
+		deinterleave_float_impl = deinterleave_float_avx2;
+		deinterleave_s16_impl = deinterleave_s16_avx2;
+	} else if(__builtin_cpu_supports("sse2")) {
+		deinterleave_float_impl = deinterleave_float_sse2;
+		deinterleave_s16_impl = deinterleave_s16_sse2;
+	}
+}
+#endif
+
+void
+bams_deinterleave_float(float * const *dst, int dst_channels,
+			const float *src, int src_channels,
+			unsigned long count)
+{
+	deinterleave_float_impl(dst, dst_channels, src, src_channels, count);
+}
+
+void
+bams_deinterleave_s16(float * const *dst, int dst_channels,
+		      const int16_t *src, int src_channels,
+		      unsigned long count)
+{
+	deinterleave_s16_impl(dst, dst_channels, src, src_channels, count);
+}
+
+#if defined __cplusplus
+} /* extern "C" */
+#endif
@@ -0,0 +1,61 @@
+/*
+ * Copyright(c) 2011 by Gabriel M. Beddingfield <gabriel@teuton.org>
+ *
+ * This file is part of BAMS (Basic Audio Mixing Subroutines)
+ *
+ * BAMS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Tritium is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY, without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+#ifndef __LIBBAMS_BAMS_DEINTERLEAVE_H__
+#define __LIBBAMS_BAMS_DEINTERLEAVE_H__
+
+#include <stdint.h>
+
+#if defined __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * Deinterleave routines
+ *
+ * Split count frames of interleaved audio (src_channels samples
+ * per frame) into planar float buffers.  Destination channel k
+ * gets source channel k.  Source channels past dst_channels are
+ * dropped.  dst_channels must be <= src_channels.
+ *
+ * The source is in native byte order.  Buffers need not be
+ * aligned.
+ *
+ * On x86, the SSE2 or AVX2 version is chosen at runtime according
+ * to what the CPU supports.
+ */
+void
+bams_deinterleave_float(float * const *dst, int dst_channels,
+			const float *src, int src_channels,
+			unsigned long count);
+
+/* Converts to float with the range [-1.0, 1.0).
+ */
+void
+bams_deinterleave_s16(float * const *dst, int dst_channels,
+		      const int16_t *src, int src_channels,
+		      unsigned long count);
+
+#if defined __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* __LIBBAMS_BAMS_DEINTERLEAVE_H__ */
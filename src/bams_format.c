@@ -26,6 +26,18 @@
 #include <endian.h>
 #include <assert.h>
 #include <string.h>
+#include <math.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define BAMS_HAVE_AVX2 1
+#endif
 
 #if __BYTE_ORDER == __LITTLE_ENDIAN
 /* ok */
@@ -273,6 +285,530 @@ bams_copy_u16be_floatbe(
 #endif
 }
 
+/* 24 bit conversions
+ *
+ * Scaling and clipping match float_24() in jack_memops.c, so the
+ * results are the same with or without SIMD.
+ */
+
+#define BAMS_24BIT_SCALING  8388607.0f
+#define BAMS_24BIT_MAX_F    8388607.0f
+#define BAMS_24BIT_MIN_F   -8388607.0f
+
+/* Frames converted per pass.  The source and dither noise go
+ * through buffers on the stack.
+ */
+#define BAMS_BLOCK 64
+
+typedef enum {
+	BAMS_S24LE3,  /* 3 bytes */
+	BAMS_S24LE4,  /* 4 bytes, sign extended */
+	BAMS_S32LE    /* 4 bytes, 24 bits in the upper bytes */
+} bams_s24_layout_t;
+
+/* Scale, add noise (if any), clip, and round to nearest.
+ */
+static void
+bams_float_to_s24(int32_t *dst, const float *src, const float *noise, unsigned long count)
+{
+	unsigned long k = 0;
+	float x;
+
+#if defined(__SSE2__)
+	const __m128 scale = _mm_set1_ps(BAMS_24BIT_SCALING);
+	const __m128 hi = _mm_set1_ps(BAMS_24BIT_MAX_F);
+	const __m128 lo = _mm_set1_ps(BAMS_24BIT_MIN_F);
+	__m128 v;
+
+	for( ; k + 4 <= count ; k += 4) {
+		v = _mm_mul_ps(_mm_loadu_ps(src + k), scale);
+		if(noise)
+			v = _mm_add_ps(v, _mm_loadu_ps(noise + k));
+		v = _mm_and_ps(v, _mm_cmpord_ps(v, v)); /* NaN -> 0, like lrintf() */
+		v = _mm_min_ps(_mm_max_ps(v, lo), hi);
+		_mm_storeu_si128((__m128i*)(dst + k), _mm_cvtps_epi32(v));
+	}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	const float32x4_t hi = vdupq_n_f32(BAMS_24BIT_MAX_F);
+	const float32x4_t lo = vdupq_n_f32(BAMS_24BIT_MIN_F);
+	float32x4_t v;
+
+	for( ; k + 4 <= count ; k += 4) {
+		v = vmulq_n_f32(vld1q_f32(src + k), BAMS_24BIT_SCALING);
+		if(noise)
+			v = vaddq_f32(v, vld1q_f32(noise + k));
+		v = vminq_f32(vmaxq_f32(v, lo), hi);
+		vst1q_s32(dst + k, vcvtnq_s32_f32(v));
+	}
+#endif
+	for( ; k < count ; ++k) {
+		x = src[k] * BAMS_24BIT_SCALING;
+		if(noise)
+			x += noise[k];
+		if(x <= BAMS_24BIT_MIN_F) {
+			x = BAMS_24BIT_MIN_F;
+		} else if(x >= BAMS_24BIT_MAX_F) {
+			x = BAMS_24BIT_MAX_F;
+		}
+		dst[k] = lrintf(x);
+	}
+}
+
+/* High-passed triangular noise, +/- 1 LSB: the difference of
+ * this uniform value and the last one (state->rm1).
+ * state->idx is the seed of the generator, so that each channel
+ * has its own.
+ */
+static void
+bams_tpdf(float *noise, unsigned long count, dither_state_t *state)
+{
+	float r;
+
+	while(count--) {
+		state->idx = (state->idx * 96314165) + 907633515;
+		r = (float)state->idx / 4294967295.0f - 0.5f;
+		(*noise++) = r - state->rm1;
+		state->rm1 = r;
+	}
+}
+
+static void
+bams_copy_s24_float(void *dst, bams_s24_layout_t layout, int dst_stride,
+		    const float *src, int swap_src, unsigned long count,
+		    dither_state_t *state)
+{
+	float in[BAMS_BLOCK], noise[BAMS_BLOCK];
+	int32_t out[BAMS_BLOCK];
+	const int size = (layout == BAMS_S24LE3) ? 3 : 4;
+	unsigned char *d = (unsigned char*)dst;
+	unsigned long n, k;
+	const float *s;
+	uint32_t v;
+
+	while(count) {
+		n = (count < BAMS_BLOCK) ? count : BAMS_BLOCK;
+		s = src;
+		if(swap_src) {
+			memcpy(in, src, n * sizeof(float));
+			bams_byte_reorder_in_place(in, sizeof(float), 1, n);
+			s = in;
+		}
+		if(state)
+			bams_tpdf(noise, n, state);
+		bams_float_to_s24(out, s, state ? noise : 0, n);
+
+		for(k = 0 ; k < n ; ++k) {
+			v = (uint32_t)out[k];
+			if(layout == BAMS_S32LE)
+				v <<= 8;
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+			memcpy(d, &v, size);
+#else
+			d[0] = (unsigned char)v;
+			d[1] = (unsigned char)(v >> 8);
+			d[2] = (unsigned char)(v >> 16);
+			if(size == 4)
+				d[3] = (unsigned char)(v >> 24);
+#endif
+			d += dst_stride * size;
+		}
+		src += n;
+		count -= n;
+	}
+}
+
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+#define BAMS_SWAP_FLOATLE 0
+#define BAMS_SWAP_FLOATBE 1
+#else
+#define BAMS_SWAP_FLOATLE 1
+#define BAMS_SWAP_FLOATBE 0
+#endif
+
+#define BAMS_COPY_S24_IMPL(d, s, layout, swap)				\
+	BAMS_COPY(d, s)							\
+	{								\
+		assert(src_stride == 1);				\
+		bams_copy_s24_float(dst, layout, dest_stride, src, swap, count, 0); \
+	}								\
+	BAMS_COPY_DITHER(d, s)						\
+	{								\
+		assert(src_stride == 1);				\
+		bams_copy_s24_float(dst, layout, dest_stride, src, swap, count, state); \
+	}
+
+BAMS_COPY_S24_IMPL(s24le3, floatle, BAMS_S24LE3, BAMS_SWAP_FLOATLE)
+BAMS_COPY_S24_IMPL(s24le4, floatle, BAMS_S24LE4, BAMS_SWAP_FLOATLE)
+BAMS_COPY_S24_IMPL(s32le, floatle, BAMS_S32LE, BAMS_SWAP_FLOATLE)
+BAMS_COPY_S24_IMPL(s24le3, floatbe, BAMS_S24LE3, BAMS_SWAP_FLOATBE)
+BAMS_COPY_S24_IMPL(s24le4, floatbe, BAMS_S24LE4, BAMS_SWAP_FLOATBE)
+BAMS_COPY_S24_IMPL(s32le, floatbe, BAMS_S32LE, BAMS_SWAP_FLOATBE)
+
+/* 16 bit stereo conversions
+ *
+ * Both channels are converted and interleaved in one pass.
+ * Clipping and rounding match float_16() in jack_memops.c, so the
+ * output is the same for every kernel.
+ */
+
+#define BAMS_16BIT_SCALING  32767.0f
+
+typedef void (*bams_s16_stereo_kernel_t)(int16_t *dst, const float *left,
+					 const float *right, unsigned long count,
+					 int swap);
+
+static inline int16_t
+bams_float_to_s16(float s)
+{
+	if(s <= -1.0f) {
+		return -32767;
+	} else if(s >= 1.0f) {
+		return 32767;
+	}
+	return (int16_t)lrintf(s * BAMS_16BIT_SCALING);
+}
+
+static inline int16_t
+bams_swap16(int16_t v)
+{
+	return (int16_t)(((uint16_t)v << 8) | ((uint16_t)v >> 8));
+}
+
+static void
+bams_s16_stereo_scalar(int16_t *dst, const float *left, const float *right,
+		       unsigned long count, int swap)
+{
+	int16_t l, r;
+
+	while(count--) {
+		l = bams_float_to_s16(*left++);
+		r = bams_float_to_s16(*right++);
+		if(swap) {
+			l = bams_swap16(l);
+			r = bams_swap16(r);
+		}
+		(*dst++) = l;
+		(*dst++) = r;
+	}
+}
+
+#if defined(__SSE2__)
+static inline __m128i
+bams_s16_sse2(__m128 v)
+{
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 minus_one = _mm_set1_ps(-1.0f);
+
+	v = _mm_and_ps(v, _mm_cmpord_ps(v, v)); /* NaN -> 0, like lrintf() */
+	v = _mm_min_ps(_mm_max_ps(v, minus_one), one);
+	return _mm_cvtps_epi32(_mm_mul_ps(v, _mm_set1_ps(BAMS_16BIT_SCALING)));
+}
+
+static void
+bams_s16_stereo_sse2(int16_t *dst, const float *left, const float *right,
+		     unsigned long count, int swap)
+{
+	__m128i l, r, a, b;
+
+	for( ; count >= 4 ; count -= 4) {
+		l = bams_s16_sse2(_mm_loadu_ps(left));
+		r = bams_s16_sse2(_mm_loadu_ps(right));
+		a = _mm_unpacklo_epi32(l, r);
+		b = _mm_unpackhi_epi32(l, r);
+		a = _mm_packs_epi32(a, b);
+		if(swap)
+			a = _mm_or_si128(_mm_slli_epi16(a, 8), _mm_srli_epi16(a, 8));
+		_mm_storeu_si128((__m128i*)dst, a);
+		left += 4;
+		right += 4;
+		dst += 8;
+	}
+	bams_s16_stereo_scalar(dst, left, right, count, swap);
+}
+#endif /* __SSE2__ */
+
+#if defined(BAMS_HAVE_AVX2)
+__attribute__((target("avx2")))
+static inline __m256i
+bams_s16_avx2(__m256 v)
+{
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 minus_one = _mm256_set1_ps(-1.0f);
+
+	v = _mm256_and_ps(v, _mm256_cmp_ps(v, v, _CMP_ORD_Q));
+	v = _mm256_min_ps(_mm256_max_ps(v, minus_one), one);
+	return _mm256_cvtps_epi32(_mm256_mul_ps(v, _mm256_set1_ps(BAMS_16BIT_SCALING)));
+}
+
+__attribute__((target("avx2")))
+static void
+bams_s16_stereo_avx2(int16_t *dst, const float *left, const float *right,
+		     unsigned long count, int swap)
+{
+	__m256i l, r, a, b;
+
+	for( ; count >= 8 ; count -= 8) {
+		l = bams_s16_avx2(_mm256_loadu_ps(left));
+		r = bams_s16_avx2(_mm256_loadu_ps(right));
+		/* unpack and pack work within 128 bit lanes, which
+		 * leaves frames 0-3 in the low lane and 4-7 in the
+		 * high one: already in order.
+		 */
+		a = _mm256_unpacklo_epi32(l, r);
+		b = _mm256_unpackhi_epi32(l, r);
+		a = _mm256_packs_epi32(a, b);
+		if(swap)
+			a = _mm256_or_si256(_mm256_slli_epi16(a, 8), _mm256_srli_epi16(a, 8));
+		_mm256_storeu_si256((__m256i*)dst, a);
+		left += 8;
+		right += 8;
+		dst += 16;
+	}
+	bams_s16_stereo_scalar(dst, left, right, count, swap);
+}
+#endif /* BAMS_HAVE_AVX2 */
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+static inline int16x4_t
+bams_s16_neon(float32x4_t v)
+{
+	/* NaN -> 0 in vcvtnq, like lrintf() */
+	v = vminq_f32(vmaxq_f32(v, vdupq_n_f32(-1.0f)), vdupq_n_f32(1.0f));
+	return vmovn_s32(vcvtnq_s32_f32(vmulq_n_f32(v, BAMS_16BIT_SCALING)));
+}
+
+static void
+bams_s16_stereo_neon(int16_t *dst, const float *left, const float *right,
+		     unsigned long count, int swap)
+{
+	int16x4x2_t v;
+
+	for( ; count >= 4 ; count -= 4) {
+		v.val[0] = bams_s16_neon(vld1q_f32(left));
+		v.val[1] = bams_s16_neon(vld1q_f32(right));
+		if(swap) {
+			v.val[0] = vreinterpret_s16_u8(vrev16_u8(vreinterpret_u8_s16(v.val[0])));
+			v.val[1] = vreinterpret_s16_u8(vrev16_u8(vreinterpret_u8_s16(v.val[1])));
+		}
+		vst2_s16(dst, v);
+		left += 4;
+		right += 4;
+		dst += 8;
+	}
+	bams_s16_stereo_scalar(dst, left, right, count, swap);
+}
+#endif /* __ARM_NEON && __aarch64__ */
+
+/* The best kernel for this CPU.  Chosen once, when the library
+ * is loaded.
+ */
+#if defined(__SSE2__)
+static bams_s16_stereo_kernel_t bams_s16_stereo = bams_s16_stereo_sse2;
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+static bams_s16_stereo_kernel_t bams_s16_stereo = bams_s16_stereo_neon;
+#else
+static bams_s16_stereo_kernel_t bams_s16_stereo = bams_s16_stereo_scalar;
+#endif
+
+
+static void
+bams_copy_s16_stereo(int16_t *dst, const float *left, const float *right,
+		     int swap_src, int swap_dst, unsigned long count)
+{
+	float l[BAMS_BLOCK], r[BAMS_BLOCK];
+	unsigned long n;
+
+	if(!swap_src) {
+		bams_s16_stereo(dst, left, right, count, swap_dst);
+		return;
+	}
+	while(count) {
+		n = (count < BAMS_BLOCK) ? count : BAMS_BLOCK;
+		memcpy(l, left, n * sizeof(float));
+		memcpy(r, right, n * sizeof(float));
+		bams_byte_reorder_in_place(l, sizeof(float), 1, n);
+		bams_byte_reorder_in_place(r, sizeof(float), 1, n);
+		bams_s16_stereo(dst, l, r, n, swap_dst);
+		left += n;
+		right += n;
+		dst += 2 * n;
+		count -= n;
+	}
+}
+
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+#define BAMS_SWAP_S16LE 0
+#define BAMS_SWAP_S16BE 1
+#else
+#define BAMS_SWAP_S16LE 1
+#define BAMS_SWAP_S16BE 0
+#endif
+
+#define BAMS_COPY_S16_STEREO_IMPL(d, s, swap_src, swap_dst)		\
+	BAMS_COPY_STEREO(d, s)						\
+	{								\
+		bams_copy_s16_stereo(dst, left, right, swap_src, swap_dst, count); \
+	}
+
+BAMS_COPY_S16_STEREO_IMPL(s16le, floatle, BAMS_SWAP_FLOATLE, BAMS_SWAP_S16LE)
+BAMS_COPY_S16_STEREO_IMPL(s16be, floatle, BAMS_SWAP_FLOATLE, BAMS_SWAP_S16BE)
+BAMS_COPY_S16_STEREO_IMPL(s16le, floatbe, BAMS_SWAP_FLOATBE, BAMS_SWAP_S16LE)
+BAMS_COPY_S16_STEREO_IMPL(s16be, floatbe, BAMS_SWAP_FLOATBE, BAMS_SWAP_S16BE)
+
+/* Float stereo: interleave, and byte swap when the orders of
+ * source and destination differ.  This is only data movement, so
+ * every kernel gives the same bits.
+ */
+
+typedef void (*bams_float_stereo_kernel_t)(uint32_t *dst, const uint32_t *left,
+					   const uint32_t *right, unsigned long count,
+					   int swap);
+
+static void
+bams_float_stereo_scalar(uint32_t *dst, const uint32_t *left, const uint32_t *right,
+			 unsigned long count, int swap)
+{
+	if(!swap) {
+		while(count--) {
+			(*dst++) = (*left++);
+			(*dst++) = (*right++);
+		}
+		return;
+	}
+	while(count--) {
+		(*dst++) = __builtin_bswap32(*left++);
+		(*dst++) = __builtin_bswap32(*right++);
+	}
+}
+
+#if defined(__SSE2__)
+static inline __m128i
+bams_bswap32_sse2(__m128i v)
+{
+	v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+	v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+	return _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+}
+
+static void
+bams_float_stereo_sse2(uint32_t *dst, const uint32_t *left, const uint32_t *right,
+		       unsigned long count, int swap)
+{
+	__m128i l, r, a, b;
+
+	for( ; count >= 4 ; count -= 4) {
+		l = _mm_loadu_si128((const __m128i*)left);
+		r = _mm_loadu_si128((const __m128i*)right);
+		a = _mm_unpacklo_epi32(l, r);
+		b = _mm_unpackhi_epi32(l, r);
+		if(swap) {
+			a = bams_bswap32_sse2(a);
+			b = bams_bswap32_sse2(b);
+		}
+		_mm_storeu_si128((__m128i*)dst, a);
+		_mm_storeu_si128((__m128i*)(dst + 4), b);
+		left += 4;
+		right += 4;
+		dst += 8;
+	}
+	bams_float_stereo_scalar(dst, left, right, count, swap);
+}
+#endif /* __SSE2__ */
+
+#if defined(BAMS_HAVE_AVX2)
+__attribute__((target("avx2")))
+static void
+bams_float_stereo_avx2(uint32_t *dst, const uint32_t *left, const uint32_t *right,
+		       unsigned long count, int swap)
+{
+	const __m256i bswap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4,
+					       11, 10, 9, 8, 15, 14, 13, 12,
+					       3, 2, 1, 0, 7, 6, 5, 4,
+					       11, 10, 9, 8, 15, 14, 13, 12);
+	__m256i l, r, a, b, lo, hi;
+
+	for( ; count >= 8 ; count -= 8) {
+		l = _mm256_loadu_si256((const __m256i*)left);
+		r = _mm256_loadu_si256((const __m256i*)right);
+		/* frames 0-1 | 4-5 and 2-3 | 6-7; the permutes put
+		 * them back in order.
+		 */
+		a = _mm256_unpacklo_epi32(l, r);
+		b = _mm256_unpackhi_epi32(l, r);
+		lo = _mm256_permute2x128_si256(a, b, 0x20);
+		hi = _mm256_permute2x128_si256(a, b, 0x31);
+		if(swap) {
+			lo = _mm256_shuffle_epi8(lo, bswap);
+			hi = _mm256_shuffle_epi8(hi, bswap);
+		}
+		_mm256_storeu_si256((__m256i*)dst, lo);
+		_mm256_storeu_si256((__m256i*)(dst + 8), hi);
+		left += 8;
+		right += 8;
+		dst += 16;
+	}
+	bams_float_stereo_scalar(dst, left, right, count, swap);
+}
+#endif /* BAMS_HAVE_AVX2 */
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+static void
+bams_float_stereo_neon(uint32_t *dst, const uint32_t *left, const uint32_t *right,
+		       unsigned long count, int swap)
+{
+	uint32x4x2_t v;
+
+	for( ; count >= 4 ; count -= 4) {
+		v.val[0] = vld1q_u32(left);
+		v.val[1] = vld1q_u32(right);
+		if(swap) {
+			v.val[0] = vreinterpretq_u32_u8(vrev32q_u8(vreinterpretq_u8_u32(v.val[0])));
+			v.val[1] = vreinterpretq_u32_u8(vrev32q_u8(vreinterpretq_u8_u32(v.val[1])));
+		}
+		vst2q_u32(dst, v);
+		left += 4;
+		right += 4;
+		dst += 8;
+	}
+	bams_float_stereo_scalar(dst, left, right, count, swap);
+}
+#endif /* __ARM_NEON && __aarch64__ */
+
+#if defined(__SSE2__)
+static bams_float_stereo_kernel_t bams_float_stereo = bams_float_stereo_sse2;
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+static bams_float_stereo_kernel_t bams_float_stereo = bams_float_stereo_neon;
+#else
+static bams_float_stereo_kernel_t bams_float_stereo = bams_float_stereo_scalar;
+#endif
+
+#define BAMS_COPY_FLOAT_STEREO_IMPL(d, s, swap)				\
+	BAMS_COPY_STEREO(d, s)						\
+	{								\
+		bams_float_stereo((uint32_t*)dst, (const uint32_t*)left, \
+				  (const uint32_t*)right, count, swap);	\
+	}
+
+BAMS_COPY_FLOAT_STEREO_IMPL(floatle, floatle, 0)
+BAMS_COPY_FLOAT_STEREO_IMPL(floatbe, floatle, 1)
+BAMS_COPY_FLOAT_STEREO_IMPL(floatle, floatbe, 1)
+BAMS_COPY_FLOAT_STEREO_IMPL(floatbe, floatbe, 0)
+
+#if defined(BAMS_HAVE_AVX2)
+/* Use AVX2 kernels when the CPU has them.
+ */
+__attribute__((constructor))
+static void
+bams_select_kernels(void)
+{
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2")) {
+		bams_s16_stereo = bams_s16_stereo_avx2;
+		bams_float_stereo = bams_float_stereo_avx2;
+	}
+}
+#endif
+
 #if defined __cplusplus
 } /* extern "C" */
 #endif
@@ -22,6 +22,7 @@
 #define __LIBBAMS_BAMS_FORMAT_H__
 
 #include <stdint.h>
+#include "jack_memops.h"
 
 #if defined __cplusplus
 extern "C"
@@ -78,8 +79,8 @@ typedef  int16_t bams_sample_s16le_t;
 typedef  int16_t bams_sample_s16be_t;
 typedef  uint16_t bams_sample_u16le_t;
 typedef  uint16_t bams_sample_u16be_t;
+typedef  struct { uint8_t b[3]; } bams_sample_s24le3_t;
 /*
-typedef  bams_sample_s24le3_t;
 typedef  bams_sample_s24be3_t;
 typedef  bams_sample_u24le3_t;
 typedef  bams_sample_u24be3_t;
@@ -106,6 +107,31 @@ typedef  float bams_sample_floatbe_t;
 		unsigned long count		    \
 		)
 
+/* Same, with TPDF dither at the destination's LSB.  The dither
+ * state must be zeroed before first use, and kept for each
+ * channel.
+ */
+#define BAMS_COPY_DITHER(d, s)			    \
+	void bams_copy_ ## d ## _ ## s ## _dither(	    \
+		bams_sample_ ## d ## _t *dst,		    \
+		int dest_stride,		    \
+		bams_sample_ ## s ## _t *src,		    \
+		int src_stride,			    \
+		unsigned long count,		    \
+		dither_state_t *state		    \
+		)
+
+/* Stereo: convert left and right and interleave them into dst
+ * (2 samples per frame) in one pass.
+ */
+#define BAMS_COPY_STEREO(d, s)			    \
+	void bams_copy_ ## d ## _ ## s ## _stereo(	    \
+		bams_sample_ ## d ## _t *dst,		    \
+		const bams_sample_ ## s ## _t *left,	    \
+		const bams_sample_ ## s ## _t *right,	    \
+		unsigned long count		    \
+		)
+
 
 /* Function prototypes
  *
@@ -121,6 +147,33 @@ BAMS_COPY(u16be, floatle);
 BAMS_COPY(u16le, floatbe);
 BAMS_COPY(u16be, floatbe);
 
+/* 24 bit output has 24 bits of precision.  So does s32, which
+ * has the sample in its upper 24 bits.  These are vectorized
+ * (SSE2 or NEON) when the compiler allows it.
+ */
+BAMS_COPY(s24le3, floatle);
+BAMS_COPY(s24le4, floatle);
+BAMS_COPY(s32le, floatle);
+BAMS_COPY(s24le3, floatbe);
+BAMS_COPY(s24le4, floatbe);
+BAMS_COPY(s32le, floatbe);
+BAMS_COPY_DITHER(s24le3, floatle);
+BAMS_COPY_DITHER(s24le4, floatle);
+BAMS_COPY_DITHER(s32le, floatle);
+BAMS_COPY_DITHER(s24le3, floatbe);
+BAMS_COPY_DITHER(s24le4, floatbe);
+BAMS_COPY_DITHER(s32le, floatbe);
+
+/* Vectorized (SSE2, AVX2 or NEON, picked at run time). */
+BAMS_COPY_STEREO(s16le, floatle);
+BAMS_COPY_STEREO(s16be, floatle);
+BAMS_COPY_STEREO(s16le, floatbe);
+BAMS_COPY_STEREO(s16be, floatbe);
+BAMS_COPY_STEREO(floatle, floatle);
+BAMS_COPY_STEREO(floatbe, floatle);
+BAMS_COPY_STEREO(floatle, floatbe);
+BAMS_COPY_STEREO(floatbe, floatbe);
+
 /* UTILITY FUNCTIONS
  *
  * size is in bytes, not bits.
@@ -0,0 +1,283 @@
+/*
+ * Copyright(c) 2011 by Gabriel M. Beddingfield <gabriel@teuton.org>
+ *
+ * This file is part of BAMS (Basic Audio Mixing Subroutines)
+ *
+ * BAMS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Tritium is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY, without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "bams_pack.h"
+
+#include <math.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BAMS_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+#if defined __cplusplus
+extern "C"
+{
+#endif
+
+#define S16_SCALING 32768.0f
+#define S16_MAX 32767.0f
+#define S16_MIN -32768.0f
+
+typedef void (*pack_s16_t)(int16_t *dst, const float *src, unsigned long count);
+typedef void (*pack_f16_t)(uint16_t *dst, const float *src, unsigned long count);
+typedef void (*unpack_f16_t)(float *dst, const uint16_t *src, unsigned long count);
+
+typedef union {
+	float f;
+	uint32_t u;
+} float_bits_t;
+
+/* Generic (scalar) versions.
+ */
+
+static void
+pack_s16_c(int16_t *dst, const float *src, unsigned long count)
+{
+	unsigned long k;
+	float x;
+
+	for(k = 0 ; k < count ; ++k) {
+		x = src[k] * S16_SCALING;
+		if(x != x) x = 0.0f; /* NaN */
+		if(x > S16_MAX) x = S16_MAX;
+		if(x < S16_MIN) x = S16_MIN;
+		dst[k] = (int16_t)lrintf(x);
+	}
+}
+
+static uint16_t
+float_to_half(float f)
+{
+	float_bits_t v;
+	uint32_t sign, x, m, r, rem, half, shift;
+
+	v.f = f;
+	sign = (v.u >> 16) & 0x8000;
+	x = v.u & 0x7fffffff;
+
+	if(x >= 0x7f800000) {
+		/* Inf or NaN */
+		return sign | 0x7c00 | ((x > 0x7f800000) ? (0x200 | ((x >> 13) & 0x3ff)) : 0);
+	}
+	if(x >= 0x477ff000) {
+		/* Rounds to 65520 or more: overflow */
+		return sign | 0x7c00;
+	}
+	if(x < 0x38800000) {
+		/* Below 2^-14: a half subnormal, in units of 2^-24 */
+		if(x < 0x33000000)
+			return sign;
+		m = (x & 0x7fffff) | 0x800000;
+		shift = 126 - (x >> 23);
+		r = m >> shift;
+		rem = m & ((1u << shift) - 1);
+		half = 1u << (shift - 1);
+		if(rem > half || (rem == half && (r & 1)))
+			++r;
+		return sign | r;
+	}
+	/* Normal: rebias the exponent and round off 13 bits */
+	r = (x - 0x38000000) >> 13;
+	rem = x & 0x1fff;
+	if(rem > 0x1000 || (rem == 0x1000 && (r & 1)))
+		++r;
+	return sign | r;
+}
+
+static float
+half_to_float(uint16_t h)
+{
+	float_bits_t v;
+	uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+	uint32_t e = (h >> 10) & 0x1f;
+	uint32_t m = h & 0x3ff;
+
+	if(e == 0) {
+		/* Zero or subnormal */
+		v.f = (float)m * (1.0f / 16777216.0f);
+		v.u |= sign;
+	} else if(e == 31) {
+		/* NaNs come out quiet, as with F16C */
+		v.u = sign | 0x7f800000 | (m << 13) | (m ? 0x400000 : 0);
+	} else {
+		v.u = sign | ((e + 112) << 23) | (m << 13);
+	}
+	return v.f;
+}
+
+static void
+pack_f16_c(uint16_t *dst, const float *src, unsigned long count)
+{
+	unsigned long k;
+
+	for(k = 0 ; k < count ; ++k)
+		dst[k] = float_to_half(src[k]);
+}
+
+static void
+unpack_f16_c(float *dst, const uint16_t *src, unsigned long count)
+{
+	unsigned long k;
+
+	for(k = 0 ; k < count ; ++k)
+		dst[k] = half_to_float(src[k]);
+}
+
+#ifdef BAMS_X86_SIMD
+
+/* SSE2 and AVX2 versions.  The clipping is done in float, before
+ * the conversion, because out-of-range conversions give INT_MIN.
+ * NaN is masked to 0 first, since min/max would clip it to S16_MIN.
+ */
+
+__attribute__((target("sse2")))
+static void
+pack_s16_sse2(int16_t *dst, const float *src, unsigned long count)
+{
+	const __m128 scale = _mm_set1_ps(S16_SCALING);
+	const __m128 hi = _mm_set1_ps(S16_MAX);
+	const __m128 lo = _mm_set1_ps(S16_MIN);
+	unsigned long k, n;
+	__m128 a, b;
+
+	n = count & ~7UL;
+	for(k = 0 ; k < n ; k += 8) {
+		a = _mm_loadu_ps(src + k);
+		b = _mm_loadu_ps(src + k + 4);
+		a = _mm_and_ps(a, _mm_cmpord_ps(a, a));
+		b = _mm_and_ps(b, _mm_cmpord_ps(b, b));
+		a = _mm_min_ps(_mm_max_ps(_mm_mul_ps(a, scale), lo), hi);
+		b = _mm_min_ps(_mm_max_ps(_mm_mul_ps(b, scale), lo), hi);
+		_mm_storeu_si128((__m128i*)(dst + k),
+				 _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b)));
+	}
+	pack_s16_c(dst + k, src + k, count - k);
+}
+
+__attribute__((target("avx2")))
+static void
+pack_s16_avx2(int16_t *dst, const float *src, unsigned long count)
+{
+	const __m256 scale = _mm256_set1_ps(S16_SCALING);
+	const __m256 hi = _mm256_set1_ps(S16_MAX);
+	const __m256 lo = _mm256_set1_ps(S16_MIN);
+	unsigned long k, n;
+	__m256 a, b;
+	__m256i x;
+
+	n = count & ~15UL;
+	for(k = 0 ; k < n ; k += 16) {
+		a = _mm256_loadu_ps(src + k);
+		b = _mm256_loadu_ps(src + k + 8);
+		a = _mm256_and_ps(a, _mm256_cmp_ps(a, a, _CMP_ORD_Q));
+		b = _mm256_and_ps(b, _mm256_cmp_ps(b, b, _CMP_ORD_Q));
+		a = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(a, scale), lo), hi);
+		b = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(b, scale), lo), hi);
+		/* The pack works within 128-bit lanes, which leaves
+		 * the 64-bit quarters in the order 0, 2, 1, 3.
+		 */
+		x = _mm256_packs_epi32(_mm256_cvtps_epi32(a), _mm256_cvtps_epi32(b));
+		x = _mm256_permute4x64_epi64(x, _MM_SHUFFLE(3, 1, 2, 0));
+		_mm256_storeu_si256((__m256i*)(dst + k), x);
+	}
+	pack_s16_c(dst + k, src + k, count - k);
+}
+
+/* F16C versions.
+ */
+
+__attribute__((target("avx,f16c")))
+static void
+pack_f16_f16c(uint16_t *dst, const float *src, unsigned long count)
+{
+	unsigned long k, n;
+
+	n = count & ~7UL;
+	for(k = 0 ; k < n ; k += 8) {
+		_mm_storeu_si128((__m128i*)(dst + k),
+				 _mm256_cvtps_ph(_mm256_loadu_ps(src + k), _MM_FROUND_TO_NEAREST_INT));
+	}
+	pack_f16_c(dst + k, src + k, count - k);
+}
+
+__attribute__((target("avx,f16c")))
+static void
+unpack_f16_f16c(float *dst, const uint16_t *src, unsigned long count)
+{
+	unsigned long k, n;
+
+	n = count & ~7UL;
+	for(k = 0 ; k < n ; k += 8) {
+		_mm256_storeu_ps(dst + k,
+				 _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(src + k))));
+	}
+	unpack_f16_c(dst + k, src + k, count - k);
+}
+
+#endif /* BAMS_X86_SIMD */
+
+/* Runtime selection.  See bams_deinterleave.c
+ */
+
+static pack_s16_t pack_s16_impl = pack_s16_c;
+static pack_f16_t pack_f16_impl = pack_f16_c;
+static unpack_f16_t unpack_f16_impl = unpack_f16_c;
+
+#ifdef BAMS_X86_SIMD
+__attribute__((constructor))
+static void
+pack_select(void)
+{
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2")) {
+		pack_s16_impl = pack_s16_avx2;
+	} else if(__builtin_cpu_supports("sse2")) {
+		pack_s16_impl = pack_s16_sse2;
+	}
+	if(__builtin_cpu_supports("avx") && __builtin_cpu_supports("f16c")) {
+		pack_f16_impl = pack_f16_f16c;
+		unpack_f16_impl = unpack_f16_f16c;
+	}
+}
+#endif
+
+void
+bams_pack_s16(int16_t *dst, const float *src, unsigned long count)
+{
+	pack_s16_impl(dst, src, count);
+}
+
+void
+bams_pack_f16(uint16_t *dst, const float *src, unsigned long count)
+{
+	pack_f16_impl(dst, src, count);
+}
+
+void
+bams_unpack_f16(float *dst, const uint16_t *src, unsigned long count)
+{
+	unpack_f16_impl(dst, src, count);
+}
+
+#if defined __cplusplus
+} /* extern "C" */
+#endif
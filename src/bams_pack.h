@@ -0,0 +1,62 @@
+/*
+ * Copyright(c) 2011 by Gabriel M. Beddingfield <gabriel@teuton.org>
+ *
+ * This file is part of BAMS (Basic Audio Mixing Subroutines)
+ *
+ * BAMS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Tritium is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY, without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+#ifndef __LIBBAMS_BAMS_PACK_H__
+#define __LIBBAMS_BAMS_PACK_H__
+
+#include <stdint.h>
+
+#if defined __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * Compact sample storage
+ *
+ * Convert count floats to and from a 16-bit storage format, in
+ * native byte order.  Buffers need not be aligned.
+ *
+ * On x86, SSE2/AVX2 (for s16) or F16C (for half floats) versions
+ * are chosen at runtime according to what the CPU supports.  They
+ * give the same results as the generic versions.
+ */
+
+/* Float [-1.0, 1.0) to signed 16-bit, rounded to nearest and
+ * clipped.  To convert back, use bams_deinterleave_s16() with one
+ * channel.
+ */
+void
+bams_pack_s16(int16_t *dst, const float *src, unsigned long count);
+
+/* Float to and from IEEE 754 half precision, rounded to nearest
+ * even.
+ */
+void
+bams_pack_f16(uint16_t *dst, const float *src, unsigned long count);
+
+void
+bams_unpack_f16(float *dst, const uint16_t *src, unsigned long count);
+
+#if defined __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* __LIBBAMS_BAMS_PACK_H__ */
@@ -28,8 +28,97 @@
 #include <iostream>
 #include <memory>
 #include <stdexcept>
+#include <string>
+#include <thread>
 
 #include "Engine.hpp"
+#include "OfflineRenderer.hpp"
+#include "BatchRenderer.hpp"
+#include <sys/time.h>
+
+/**
+ * Tells the user when playback is waiting for a file to load.
+ */
+class UnderrunReporter : public StretchPlayer::EngineMessageCallback
+{
+public:
+	void operator()(const char *message) {
+	printf("u\n");
+	}
+};
+
+/**
+ * --render: stretch the startup file into render_file, without
+ * opening the audio device.
+ */
+static int render_offline(StretchPlayer::Configuration& config)
+{
+	StretchPlayer::OfflineRenderer renderer;
+	StretchPlayer::OfflineRenderer::job_t job;
+	char err[1024] = "";
+	bool quiet = config.quiet();
+
+	job.input = config.startup_file();
+	job.output = config.render_file();
+	job.stretch = (float)config.stretch()/100.f;
+	job.pitch = config.pitch();
+	job.shift = config.shift();
+	job.mono = config.mono();
+
+	if (!quiet) {
+		renderer.set_progress_callback([](float progress, float speed) {
+			fprintf(stderr, "\rrendering: %3d%%  (%.1fx realtime)", int(100 * progress), speed);
+		});
+	}
+	if (!renderer.render(job, err, sizeof(err))) {
+		if (!quiet)
+			fprintf(stderr, "\n");
+		printf("0%s\n", err);
+		return 1;
+	}
+	if (!quiet)
+		fprintf(stderr, "\n");
+	return 0;
+}
+
+/**
+ * --batch: render every job in batch_file on a pool of threads.
+ */
+static int render_batch(StretchPlayer::Configuration& config)
+{
+	StretchPlayer::BatchRenderer batch(config.jobs());
+	char err[1024] = "";
+	bool quiet = config.quiet();
+	timeval a, b;
+
+	if (!batch.read_list(config.batch_file(), config.mono(), config.shift(), err, sizeof(err))) {
+		printf("0%s\n", err);
+		return 1;
+	}
+
+	size_t total = batch.size(), finished = 0;
+	batch.set_done_callback([&](size_t index, const StretchPlayer::BatchRenderer::job_t& job,
+				    const char *err_msg) {
+		++finished;
+		if (err_msg)
+			printf("0%s\n", err_msg);
+		else if (!quiet)
+			fprintf(stderr, "[%lu/%lu] %s\n", (unsigned long)finished,
+				(unsigned long)total, job.output);
+	});
+
+	if (!quiet)
+		fprintf(stderr, "rendering %lu files on %u threads\n", (unsigned long)total,
+			batch.threads());
+	gettimeofday(&a, 0);
+	size_t failed = batch.run();
+	gettimeofday(&b, 0);
+	if (!quiet)
+		fprintf(stderr, "done in %.1f s, %lu failed\n",
+			(b.tv_sec - a.tv_sec) + (b.tv_usec - a.tv_usec) / 1000000.0,
+			(unsigned long)failed);
+	return failed ? 1 : 0;
+}
 
 int main(int argc, char* argv[])
 {
@@ -45,8 +134,17 @@ int main(int argc, char* argv[])
 	config.copyright();
 	}
 
+	if (config.render_file()) {
+		return render_offline(config);
+	}
+	if (config.batch_file()) {
+		return render_batch(config);
+	}
+
 	std::unique_ptr<StretchPlayer::EngineMessageCallback> _engine_callback;
 	std::unique_ptr<StretchPlayer::Engine> _engine(new StretchPlayer::Engine(&config));
+	_engine_callback.reset(new UnderrunReporter);
+	_engine->subscribe_underruns(_engine_callback.get());
 
 	_engine->set_shift(config.shift());
 	_engine->set_stretch((float)config.stretch()/100.f);
@@ -60,6 +158,7 @@ int main(int argc, char* argv[])
 
 	if (!config.quiet())
 		printf("enter a command (enter \"h\" for help).\n");
+	std::thread loader; // songs load in the background so that commands keep working
 	char c;
 	ssize_t dataLen;
 	char str[1024];
@@ -103,15 +202,29 @@ int main(int argc, char* argv[])
 #   5 - current playing position (in milliseconds)
 #   6 - playing speed. Appears as response for commands 2, 3, and 6.
 #   7 - frequency shift (number from -12 to 12). Appears as response for commands 2, 3 and 7.
+#   u - playback is waiting for the file to finish loading (with --progressive)
 ##################################
 )");
 		}
 		else if (c == '1')
 		{
-			_engine->load_song(paramString);
+			if (loader.joinable())
+				loader.join();
+			std::string filename(paramString);
+			StretchPlayer::Engine *engine = _engine.get();
+			loader = std::thread([engine, filename]() {
+				if (engine->load_song(filename.c_str()))
+					printf("1\n");
+				else
+					printf("0can't open\n");
+			});
 		}
 		else if (c == '2')
 		{
+			// Don't play the old song (or nothing) while "1"
+			// is still loading.
+			if (loader.joinable())
+				loader.join();
 			long long ll = atoll(paramString);
 			double d = ll/1000.;
 			//printf("%f\n", d);
@@ -138,6 +251,8 @@ int main(int argc, char* argv[])
 				continue;
 			}
 			printf("%lli - %lli\n", ll1, ll2);
+			if (loader.joinable())
+				loader.join();
 			double d1 = ll1/1000.;
 			_engine->locate(d1);
 			_engine->play();
@@ -171,7 +286,8 @@ int main(int argc, char* argv[])
 		else if (c == '9')
 		{
 			short i = atoi(paramString);
-			_engine->set_shift(i);
+			if (!_engine->set_shift(i))
+				printf("0shift is larger than the stream window, reopen the file\n");
 		}
 		else
 		{
@@ -179,5 +295,7 @@ int main(int argc, char* argv[])
 			printf("else: \"%s\"\n", paramString);
 		}
 	}
+	if (loader.joinable())
+		loader.join();
 	return 0;
 }